@@ -158,6 +158,10 @@ int main(const int argc, const char *argv[]) {
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
 
+        // Let the caches sample the clock once per frame rather than on every hit.
+        descriptors->tick();
+        pipelines->tick();
+
         // Start the command buffer and begin the render pass.
         VkCommandBuffer cmdbuffer = context->beginFrame();
         rpbi.framebuffer = context->getFramebuffer();
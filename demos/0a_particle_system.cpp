@@ -326,7 +326,9 @@ static void run_demo(LavaContext* context, GLFWwindow* window) {
             continue;
         }
 
-        // Record two command buffers.
+        // Record two command buffers, letting the caches sample the clock once for the pass.
+        descriptors->tick();
+        pipelines->tick();
         LavaRecording* frame = context->createRecording();
         for (uint32_t i = 0; i < 2; i++) {
             rpbi.framebuffer = context->getFramebuffer(i);
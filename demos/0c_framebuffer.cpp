@@ -6,6 +6,7 @@
 #include <par/LavaGpuBuffer.h>
 #include <par/LavaLog.h>
 #include <par/LavaPipeCache.h>
+#include <par/LavaSamplerCache.h>
 #include <par/LavaSurfCache.h>
 
 #include <par/AmberApplication.h>
@@ -48,6 +49,7 @@ struct FramebufferApp : AmberApplication {
     LavaCpuBuffer* mUniforms[2];
     VkExtent2D mResolution;
     LavaSurfCache* mSurfaces;
+    LavaSamplerCache* mSamplers;
     LavaSurface mOffscreenSurface;
     VkSampler mSampler;
 };
@@ -119,15 +121,15 @@ FramebufferApp::FramebufferApp(SurfaceFn createSurface) {
     mUniforms[1] = LavaCpuBuffer::create(cfg);
 
     // Create the sampler.
-    VkSamplerCreateInfo samplerInfo {
+    mSamplers = LavaSamplerCache::create({ .device = device });
+    mSampler = mSamplers->getSampler({
         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
         .minFilter = VK_FILTER_LINEAR,
         .magFilter = VK_FILTER_LINEAR,
         .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
         .minLod = 0.0f,
         .maxLod = 0.25f
-    };
-    vkCreateSampler(device, &samplerInfo, 0, &mSampler);
+    });
 
     // Create the descriptor set.
     mDescriptors = LavaDescCache::create({
@@ -222,7 +224,7 @@ FramebufferApp::~FramebufferApp() {
     mContext->waitRecording(mRecording);
     mContext->freeRecording(mRecording);
     mSurfaces->freeAttachment(mOffscreenSurface.color);
-    vkDestroySampler(mContext->getDevice(), mSampler, 0);
+    delete mSamplers;
     delete mSurfaces;
     delete mUniforms[0];
     delete mUniforms[1];
@@ -235,6 +237,9 @@ FramebufferApp::~FramebufferApp() {
 }
 
 void FramebufferApp::draw(double time) {
+    mDescriptors->tick();
+    mPipelines->tick();
+    mSurfaces->tick();
     Uniforms uniforms {
         .iResolution = {1200, 1200, 0, 0},
         .iTime = (float) time
@@ -0,0 +1,52 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+namespace par {
+
+// Holds one large array of sampled images in a single descriptor set that can stay bound.
+//
+// Draws that use different textures then share the same descriptor set and differ only by an
+// index, which is typically passed as a push constant. This enables batching and indirect draws.
+// The array is partially bound and updated after bind, so images can be added while the set is in
+// use. Requires VK_EXT_descriptor_indexing, which LavaContext enables when it is available.
+//
+// In GLSL, declare the array as "uniform texture2D images[]" and pair it with a separate sampler.
+//
+class LavaBindlessSet {
+public:
+    struct Config {
+        VkDevice device;
+        uint32_t capacity;             // maximum number of images, defaults to 4096
+        VkShaderStageFlags stageFlags; // defaults to VK_SHADER_STAGE_ALL
+    };
+    static constexpr uint32_t INVALID_INDEX = ~0u;
+
+    // Returns null if the device does not support descriptor indexing.
+    static LavaBindlessSet* create(Config config) noexcept;
+    static void operator delete(void* );
+
+    VkDescriptorSetLayout getLayout() const noexcept;
+    VkDescriptorSet getDescriptorSet() const noexcept;
+
+    // Writes the view into an unused slot and returns its index, or INVALID_INDEX if the array is
+    // full. These methods are thread-safe. A slot must not be unregistered or updated while
+    // commands that sample from it are still executing.
+    uint32_t registerImage(VkImageView view,
+            VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) noexcept;
+    void updateImage(uint32_t index, VkImageView view,
+            VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) noexcept;
+    void unregisterImage(uint32_t index) noexcept;
+
+    uint32_t getImageCount() const noexcept;
+protected:
+    LavaBindlessSet() noexcept = default;
+    // par::noncopyable
+    LavaBindlessSet(LavaBindlessSet const&) = delete;
+    LavaBindlessSet& operator=(LavaBindlessSet const&) = delete;
+};
+
+}
@@ -4,11 +4,14 @@
 #pragma once
 
 #include <functional>
+#include <string>
+#include <vector>
 
 #include <vulkan/vulkan.h>
 
 namespace par {
 
+class LavaStagingRing;
 struct LavaRecording;
 
 // The LavaContext owns the Vulkan instance, device, swap chain, and command buffers.
@@ -19,6 +22,21 @@ public:
         bool validation;
         VkSampleCountFlagBits samples;
         std::function<VkSurfaceKHR(VkInstance)> createSurface;
+        bool externalMemory; // enables sharing of memory and semaphores with other processes
+    };
+    struct MemoryHeap {
+        VkDeviceSize size;
+        VkDeviceSize used;
+        VkDeviceSize budget;
+        bool deviceLocal;
+    };
+    struct MemoryStats {
+        std::vector<MemoryHeap> heaps;
+        bool driverBudget;   // true if the heap numbers came from VK_EXT_memory_budget
+        VkDeviceSize textures;
+        VkDeviceSize attachments;
+        VkDeviceSize cpuBuffers;
+        VkDeviceSize gpuBuffers;
     };
     static LavaContext* create(Config config) noexcept;
     static void operator delete(void* );
@@ -48,6 +66,21 @@ public:
     void freeRecording(LavaRecording*) noexcept;
     void waitRecording(LavaRecording*) noexcept;
 
+    // Creates semaphores that can synchronize with another process via POSIX file descriptors.
+    // These require Config::externalMemory. Exporting returns a new file descriptor (or -1) that
+    // the caller owns, while importing takes ownership of the given descriptor.
+    VkSemaphore createExportableSemaphore() noexcept;
+    int exportSemaphore(VkSemaphore semaphore) noexcept;
+    VkSemaphore importSemaphore(int fd) noexcept;
+
+    // Reports device memory usage for each heap, along with the totals held by each type of Lava
+    // object. If VK_EXT_memory_budget is not available, the usage numbers only include memory
+    // allocated through Lava, and the budget is estimated as 80% of the heap size.
+    MemoryStats getMemoryStats() const noexcept;
+
+    // Returns the above stats as a JSON string, including a detailed dump of the allocator state.
+    std::string getMemoryStatsJson(bool detailed = false) const noexcept;
+
     // General accessors.
     VkInstance getInstance() const noexcept;
     VkSurfaceKHR getSurface() const noexcept;
@@ -56,12 +89,17 @@ public:
     VkPhysicalDevice getGpu() const noexcept;
     const VkPhysicalDeviceFeatures& getGpuFeatures() const noexcept;
     VkQueue getQueue() const noexcept;
+    uint32_t getQueueFamily() const noexcept;
     VkFormat getFormat() const noexcept;
     VkColorSpaceKHR getColorSpace() const noexcept;
     const VkPhysicalDeviceMemoryProperties& getMemoryProperties() const noexcept;
     VkRenderPass getRenderPass() const noexcept;
     VkSwapchainKHR getSwapchain() const noexcept;
 
+    // Textures that are not given a staging ring use this one, which is flushed before every
+    // submission made by the context. Like the ring itself, this is not thread safe.
+    LavaStagingRing* getStagingRing() const noexcept;
+
     // Swap chain related accessors.
     VkImage getImage(uint32_t i = 0) const noexcept;
     VkImageView getImageView(uint32_t i = 0) const noexcept;
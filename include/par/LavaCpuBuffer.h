@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <par/LavaMemoryPool.h>
+
 #include <vulkan/vulkan.h>
 
 namespace par {
@@ -16,6 +18,7 @@ public:
         uint32_t capacity;  // Optional capacity, must be 0 or greater than "size".
         void const* source; // if non-null, triggers a memcpy during construction
         VkBufferUsageFlags usage;
+        LavaMemoryPool pool; // AUTO picks UNIFORM, GEOMETRY or STAGING according to usage
     };    
     static LavaCpuBuffer* create(Config config) noexcept;
     static void operator delete(void* );
@@ -0,0 +1,55 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+namespace par {
+
+class LavaDescCache;
+
+// Incrementally compacts device memory used by LavaGpuBuffer, LavaTexture, and LavaSurfCache.
+//
+// Each call to step() picks the least-occupied memory block and moves its allocations into free
+// space in other blocks by recording GPU copies into the given command buffer. When a block is
+// fully evacuated, VMA releases it back to the driver. Replaced resources are destroyed a few
+// steps later, after the GPU is done with them.
+//
+// After a move, getBuffer() and getImageView() return new handles, so clients should fetch these
+// every frame rather than caching them. Descriptor caches listed in the config are notified of
+// stale handles via unsetUniformBuffer and unsetImageView. Textures registered in a
+// LavaBindlessSet are never moved, because their slots cannot be rewritten while in use.
+//
+class LavaDefragmenter {
+public:
+    struct Config {
+        VkDevice device;
+        VkPhysicalDevice gpu;
+        std::vector<LavaDescCache*> descCaches;
+        uint32_t framesInFlight;    // Defaults to 2 if zero.
+    };
+    struct Stats {
+        uint32_t movedAllocations;
+        VkDeviceSize movedBytes;
+        uint32_t failedMoves;
+    };
+    static LavaDefragmenter* create(Config config) noexcept;
+    static void operator delete(void* );
+
+    // Records copies into the given command buffer until the time budget runs out or the current
+    // block has been evacuated. Must be called outside of a render pass, once per frame, and the
+    // command buffer must be submitted before the next frame. Returns the number of moves.
+    uint32_t step(VkCommandBuffer cmd, uint64_t budgetMicroseconds) noexcept;
+
+    const Stats& getStats() const noexcept;
+protected:
+    LavaDefragmenter() noexcept = default;
+    // par::noncopyable
+    LavaDefragmenter(LavaDefragmenter const&) = delete;
+    LavaDefragmenter& operator=(LavaDefragmenter const&) = delete;
+};
+
+}
@@ -12,17 +12,28 @@ namespace par {
 // Manages a set of descriptors that all conform to a specific descriptor layout.
 //
 // Creates a single VkDescriptorSetLayout upon construction and stores it as immutable state.
-// Accepts state changes via setUniformBuffer and setImageSampler.
+// Accepts state changes via setUniformBuffer, setImageSampler, setStorageBuffer, etc.
+// Dynamic uniform buffers are keyed by their buffer info, but not by their dynamic offsets.
 // Creates or fetches a descriptor set when getDescriptor() is called.
-// Optionally frees least-recently-used descriptors via releaseUnused().
+// Optionally frees least-recently-used descriptors via evictDescriptors().
 //
 class LavaDescCache {
 public:
     struct Config {
         VkDevice device;
         std::vector<VkBuffer> uniformBuffers;
+        std::vector<VkDescriptorBufferInfo> dynamicUniformBuffers; // must have explicit ranges
         std::vector<VkDescriptorImageInfo> imageSamplers;
         std::vector<VkDescriptorImageInfo> inputAttachments;
+        std::vector<VkDescriptorBufferInfo> storageBuffers;
+        std::vector<VkDescriptorImageInfo> storageImages;
+        std::vector<VkBufferView> uniformTexelBuffers;
+        std::vector<VkBufferView> storageTexelBuffers;
+        // Optional stage flags for each binding. Missing entries default to VK_SHADER_STAGE_ALL,
+        // or VK_SHADER_STAGE_FRAGMENT_BIT for input attachments.
+        std::vector<VkShaderStageFlags> stageFlags;
+        uint32_t transientFrames; // if nonzero, sets are not cached and are recycled per frame
+        bool pushDescriptors; // if supported, bindDescriptorSet pushes instead of allocating
     };
     static LavaDescCache* create(Config config) noexcept;
     static void operator delete(void* );
@@ -39,22 +50,67 @@ public:
     VkDescriptorSet* getDescPointer() noexcept;
 
     // Fetches or creates a VkDescriptorSet corresponding to the layout that was established
-    // during construction. Returns true if the client should call vkCmdBindDescriptorSet.
-    // Sets "writes" to a non-empty vector if the client should call vkUpdateDescriptorSets.
+    // during construction. Returns true if the client should call vkCmdBindDescriptorSet, which
+    // includes the case where only the dynamic offsets have changed.
+    // Sets "writes" to a non-empty vector if the client should call vkUpdateDescriptorSets. In
+    // transient mode the writes are always applied internally, so "writes" is left empty.
+    // Performs no heap allocations unless a new descriptor pool is needed, which happens a
+    // logarithmic number of times, or "writes" has less capacity than the number of bindings.
     bool getDescriptorSet(VkDescriptorSet* descriptorSet,
             std::vector<VkWriteDescriptorSet>* writes) noexcept;
 
     void setUniformBuffer(uint32_t bindingIndex, VkBuffer uniformBuffer) noexcept;
+    void setDynamicUniformBuffer(uint32_t bindingIndex, VkDescriptorBufferInfo binding) noexcept;
     void setImageSampler(uint32_t bindingIndex, VkDescriptorImageInfo binding) noexcept;
     void setInputAttachment(uint32_t bindingIndex, VkDescriptorImageInfo binding) noexcept;
+    void setStorageBuffer(uint32_t bindingIndex, VkDescriptorBufferInfo binding) noexcept;
+    void setStorageImage(uint32_t bindingIndex, VkDescriptorImageInfo binding) noexcept;
+    void setTexelBuffer(uint32_t bindingIndex, VkBufferView bufferView) noexcept;
 
+    // Sets the offset that is added to the base offset of a dynamic uniform buffer. Offsets are not
+    // part of the cache key, so changing them never creates a new descriptor set.
+    void setDynamicOffset(uint32_t bindingIndex, uint32_t offset) noexcept;
+
+    // Returns the offsets of all dynamic uniform buffers, ordered by binding index, for passing
+    // to vkCmdBindDescriptorSets.
+    const uint32_t* getDynamicOffsets() const noexcept;
+    uint32_t getDynamicOffsetCount() const noexcept;
+
+    // Makes the current state visible to the given command buffer at the given set index. In push
+    // mode this calls vkCmdPushDescriptorSetKHR, otherwise it fetches or creates a descriptor set
+    // and calls vkCmdBindDescriptorSets. Either way it always records a command, since only the
+    // client knows whether the command buffer still has this state bound.
+    void bindDescriptorSet(VkCommandBuffer cmdbuffer, VkPipelineBindPoint bindPoint,
+            VkPipelineLayout pipelineLayout, uint32_t setIndex) noexcept;
+
+    // Returns true if push mode was requested and the device supports VK_KHR_push_descriptor.
+    bool usesPushDescriptors() const noexcept;
+
+    // Clears both regular and dynamic uniform buffers that refer to the given buffer.
     void unsetUniformBuffer(VkBuffer uniformBuffer) noexcept;
     void unsetImageSampler(VkDescriptorImageInfo binding) noexcept;
     void unsetInputAttachment(VkDescriptorImageInfo binding) noexcept;
+    void unsetStorageBuffer(VkBuffer storageBuffer) noexcept;
+    void unsetStorageImage(VkImageView imageView) noexcept;
+    void unsetTexelBuffer(VkBufferView bufferView) noexcept;
+
+    // Clears all image bindings of any type that refer to the given view, and discards
+    // cached descriptor sets that refer to it. Used when an image is moved to different memory.
+    void unsetImageView(VkImageView imageView) noexcept;
 
     // Frees descriptor sets that were last retrieved more than N milliseconds ago, and more than
-    // M frames ago. Also bumps the internal frame count.
+    // M frames ago. The cost is proportional to the number of evicted sets. Also bumps the
+    // internal frame count, unless the cache is being ticked.
     void evictDescriptors(uint64_t milliseconds, uint64_t nframes) noexcept;
+
+    // Call once per frame to advance the frame count and sample the clock, which spares each
+    // cache hit from reading the clock.
+    void tick() noexcept;
+
+    // In transient mode, releases every set that was allocated "transientFrames" frames ago with a
+    // single pool reset. Call this at the start of each frame, after waiting for the fence of the
+    // frame that previously used the same slot (e.g. after LavaContext::beginFrame).
+    void nextFrame() noexcept;
 protected:
     LavaDescCache() noexcept = default;
     // par::noncopyable
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <par/LavaMemoryPool.h>
+
 #include <vulkan/vulkan.h>
 
 namespace par {
@@ -14,11 +16,23 @@ public:
         VkPhysicalDevice gpu;
         uint32_t size;
         VkBufferUsageFlags usage;
+        bool exportable;    // if true, the memory can be shared with other processes via getFd
+        LavaMemoryPool pool; // AUTO picks GEOMETRY, UNIFORM or DEFAULT according to usage
     };    
     static LavaGpuBuffer* create(Config config) noexcept;
     static void operator delete(void* );
+
+    // Creates a buffer whose memory was exported by another process on the same device. The config
+    // must match the one used by the exporting process. Takes ownership of the file descriptor.
+    // Requires LavaContext::Config::externalMemory.
+    static LavaGpuBuffer* createFromFd(Config config, int fd) noexcept;
+
     VkBuffer getBuffer() const noexcept;
     const VkBuffer* getBufferPtr() const noexcept;
+
+    // Returns a new POSIX file descriptor for the memory, or -1 if the buffer is not exportable.
+    // The caller owns the descriptor, typically passing it to another process over a socket.
+    int getFd() const noexcept;
 protected:
     LavaGpuBuffer() noexcept = default;
     // par::noncopyable
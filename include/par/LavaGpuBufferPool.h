@@ -0,0 +1,48 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+namespace par {
+
+// Sub-allocates many small device-only buffers from a few large VkBuffer objects.
+//
+// Ranges that come from the same block share a VkBuffer, so draws can share a single call to
+// vkCmdBindVertexBuffers and select their data with firstVertex / vertexOffset. To make this
+// possible, pass the vertex stride as the alignment when allocating a range of vertices.
+//
+class LavaGpuBufferPool {
+public:
+    struct Config {
+        VkDevice device;
+        VkPhysicalDevice gpu;
+        uint32_t blockSize;         // Size of each VkBuffer, defaults to 64 MiB if zero.
+        VkBufferUsageFlags usage;
+    };
+    struct Range {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+    static LavaGpuBufferPool* create(Config config) noexcept;
+    static void operator delete(void* );
+
+    // Finds space for the given number of bytes, creating a new block if necessary. The offset of
+    // the returned range is a multiple of "alignment", which need not be a power of two. Returns a
+    // range with a null buffer if the request is larger than the block size.
+    Range allocate(uint32_t size, uint32_t alignment = 16) noexcept;
+
+    // Returns a range to the pool. Blocks that become empty are destroyed, except for the first.
+    void free(const Range& range) noexcept;
+
+    uint32_t getBlockCount() const noexcept;
+protected:
+    LavaGpuBufferPool() noexcept = default;
+    // par::noncopyable
+    LavaGpuBufferPool(LavaGpuBufferPool const&) = delete;
+    LavaGpuBufferPool& operator=(LavaGpuBufferPool const&) = delete;
+};
+
+}
@@ -0,0 +1,24 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#pragma once
+
+#include <stdint.h>
+
+namespace par {
+
+// Selects the family of memory blocks that a Lava object allocates from. Each pool has its own
+// blocks and block size, so that short-lived staging buffers and per-frame uniforms do not
+// fragment the blocks that hold long-lived textures and geometry. AUTO picks a pool according to
+// the object type and its usage flags, and DEFAULT uses the allocator's general-purpose blocks.
+enum class LavaMemoryPool : uint8_t {
+    AUTO = 0,
+    DEFAULT,
+    STAGING,
+    UNIFORM,
+    GEOMETRY,
+    ATTACHMENT,
+    TEXTURE,
+};
+
+}
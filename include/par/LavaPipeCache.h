@@ -57,8 +57,12 @@ public:
     void setFragmentShader(VkShaderModule module) noexcept;
     void setRenderPass(VkRenderPass renderPass) noexcept;
 
-    // Evicts pipeline objects that were last used more than N milliseconds ago.
+    // Evicts pipeline objects that were last used more than N milliseconds ago. The cost is
+    // proportional to the number of evicted pipelines.
     void releaseUnused(uint64_t milliseconds) noexcept;
+
+    // Call once per frame to sample the clock, which spares each cache hit from reading it.
+    void tick() noexcept;
 protected:
     LavaPipeCache() noexcept = default;
     // par::noncopyable
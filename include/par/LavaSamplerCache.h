@@ -0,0 +1,40 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+namespace par {
+
+// Shares sampler objects between clients that request identical sampler state.
+//
+// Samplers are cheap to use but the device limits how many can exist at once, and identical
+// samplers with distinct handles defeat descriptor set caching in LavaDescCache. The cache owns
+// every sampler it returns, which live until the cache is destroyed.
+//
+class LavaSamplerCache {
+public:
+    struct Config {
+        VkDevice device;
+    };
+    struct Stats {
+        uint32_t samplerCount;
+        uint64_t hits;
+        uint64_t misses;
+    };
+    static LavaSamplerCache* create(Config config) noexcept;
+    static void operator delete(void* );
+
+    // Fetches or creates a sampler. The sType and pNext fields are ignored.
+    VkSampler getSampler(const VkSamplerCreateInfo& info) noexcept;
+
+    Stats getStats() const noexcept;
+protected:
+    LavaSamplerCache() noexcept = default;
+    // par::noncopyable
+    LavaSamplerCache(LavaSamplerCache const&) = delete;
+    LavaSamplerCache& operator=(LavaSamplerCache const&) = delete;
+};
+
+}
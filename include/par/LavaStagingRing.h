@@ -0,0 +1,64 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#pragma once
+
+#include <functional>
+
+#include <vulkan/vulkan.h>
+
+namespace par {
+
+// Fixed-size ring of persistently mapped staging memory, shared by many uploads.
+//
+// Copies out of the ring are recorded into a command buffer that the ring owns and submits to the
+// given queue. When the ring runs out of space, it submits the pending copies and waits for the
+// oldest submission to complete before reusing its memory, which bounds peak staging memory to
+// "capacity" regardless of how much data is uploaded. The ring is not thread safe.
+//
+class LavaStagingRing {
+public:
+    struct Config {
+        VkDevice device;
+        VkPhysicalDevice gpu;
+        VkQueue queue;
+        uint32_t queueFamily;
+        VkDeviceSize capacity;  // defaults to 32 MiB
+    };
+    struct Allocation {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        uint8_t* mapped;        // null if the request is larger than the ring
+    };
+    static LavaStagingRing* create(Config config) noexcept;
+    static void operator delete(void* );
+
+    // Reserves a region of the ring, which might submit pending copies and wait for the GPU.
+    // The alignment must be a multiple of 4 and of the texel block size if the region is used as
+    // the source of vkCmdCopyBufferToImage.
+    Allocation allocate(VkDeviceSize size, VkDeviceSize alignment = 16) noexcept;
+
+    // Returns the command buffer into which copies out of the ring should be recorded. Call this
+    // after allocate, since allocating might submit the previous command buffer.
+    VkCommandBuffer getCommandBuffer() noexcept;
+
+    // Submits all pending copies. Work that consumes the uploaded data must be submitted to the
+    // same queue after calling this.
+    void flush() noexcept;
+
+    // Submits all pending copies and waits for them to complete.
+    void finish() noexcept;
+
+    // Runs the callback once the copies recorded so far have completed, which lets other transient
+    // resources that the copies depend on share the lifetime of their ring region.
+    void onComplete(std::function<void()> callback) noexcept;
+
+    VkDeviceSize getCapacity() const noexcept;
+protected:
+    LavaStagingRing() noexcept = default;
+    // par::noncopyable
+    LavaStagingRing(LavaStagingRing const&) = delete;
+    LavaStagingRing& operator=(LavaStagingRing const&) = delete;
+};
+
+}
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <par/LavaMemoryPool.h>
+
 #include <vulkan/vulkan.h>
 
 namespace par {
@@ -21,6 +23,13 @@ public:
 
     // Factory functions for VkImage / VkImageLayout.
     Attachment const* createColorAttachment(const AttachmentConfig& config) const noexcept;
+
+    // Cross-process sharing (requires LavaContext::Config::externalMemory). The importing process
+    // must use the same AttachmentConfig as the exporter, and the importer takes ownership of the
+    // file descriptor. Exporting returns a new descriptor, or -1 if the attachment isn't exportable.
+    Attachment const* importColorAttachment(const AttachmentConfig& config, int fd) const noexcept;
+    int getAttachmentFd(Attachment const* attachment) const noexcept;
+
     void finalizeAttachment(Attachment const* attachment, VkCommandBuffer cmdbuf) const noexcept;
     void finalizeAttachment(Attachment const* attachment, VkCommandBuffer cmdbuf,
             VkBuffer srcData, uint32_t nbytes) const noexcept;
@@ -28,11 +37,20 @@ public:
             const VkClearColorValue& clearColor) const noexcept;
     void freeAttachment(Attachment const* attachment) const noexcept;
 
+    // The cache tracks the layout of each attachment so that LavaDefragmenter can move it without
+    // disturbing its contents. Finalizing leaves an attachment in COLOR_ATTACHMENT_OPTIMAL, and
+    // getFramebuffer assumes its render pass leaves it in SHADER_READ_ONLY_OPTIMAL. Clients that
+    // record their own transitions should report the layout that holds between frames.
+    void setAttachmentLayout(Attachment const* attachment, VkImageLayout layout) const noexcept;
+
     // Cache retrieval / creation / eviction.
     VkFramebuffer getFramebuffer(const Params& params) noexcept;
     VkRenderPass getRenderPass(const Params& params, VkRenderPassBeginInfo* = nullptr) noexcept;
     void releaseUnused(uint64_t milliseconds) noexcept;
 
+    // Call once per frame to sample the clock, which spares each cache hit from reading it.
+    void tick() noexcept;
+
     struct Config {
         VkDevice device;
         VkPhysicalDevice gpu;
@@ -44,6 +62,8 @@ public:
         VkFormat format;
         bool enableUpload;
         bool enableRead;
+        bool exportable;
+        LavaMemoryPool pool; // AUTO uses ATTACHMENT
     };
 
     struct Attachment {
@@ -3,12 +3,23 @@
 
 #pragma once
 
+#include <par/LavaBindlessSet.h>
+#include <par/LavaMemoryPool.h>
+#include <par/LavaStagingRing.h>
+
+#include <functional>
+#include <vector>
+
 #include <vulkan/vulkan.h>
 
 namespace par {
 
 class LavaTexture {
 public:
+    // Writes one level of tightly packed texels directly into mapped staging memory, which avoids
+    // holding a decoded copy of the image. Called once for each of the "sourceMips" levels.
+    using Writer = std::function<void(uint8_t* texels, uint32_t level, uint32_t rowPitch)>;
+
     struct Config {
         VkDevice device;
         VkPhysicalDevice gpu;
@@ -17,12 +28,67 @@ public:
         uint32_t width;
         uint32_t height;
         VkFormat format;
+        bool mipmaps;        // allocates a full mip chain and generates missing levels on the GPU
+        uint32_t sourceMips; // number of levels in "source", tightly packed starting with level 0
+        bool externalStage;  // if true, no stage is allocated and the caller provides the texels
+        LavaStagingRing* staging; // defaults to the LavaContext's ring on the context's thread
+        LavaMemoryPool pool; // AUTO uses TEXTURE for the image, the stage always uses STAGING
+        Writer writer;       // fills the stage instead of "source", not with externalStage
+        VkFormat sourceFormat;      // if set, the texels are converted to "format" on the GPU
+        VkComponentMapping swizzle; // applied by the image view, e.g. to expand grayscale
+        LavaBindlessSet* bindless;  // if set, the view is registered for the texture's lifetime
     };
+    // Returns null if the GPU cannot convert from the source format to the texture format, or if
+    // "size" is not a multiple of the texel count when there are several levels, a writer, or a
+    // conversion. A single level of any other size is staged as-is but cannot be updated.
     static LavaTexture* create(Config config) noexcept;
     static void operator delete(void* ptr) noexcept;
+
+    // Creates a texture from the contents of a KTX or KTX2 file, staging every level as-is with
+    // no CPU decode. Only the device, gpu and pool fields of the config are used, the rest comes
+    // from the file. Returns null if the file is malformed, supercompressed, not a 2D texture, or
+    // uses a format that the GPU cannot sample from.
+    static LavaTexture* createFromKtx(Config config, void const* ktxData, size_t ktxSize) noexcept;
+
+    // Returns the format of a KTX or KTX2 file, or VK_FORMAT_UNDEFINED if it cannot be parsed.
+    static VkFormat getKtxFormat(void const* ktxData, size_t ktxSize) noexcept;
+
+    // Returns the first format that the GPU can sample from, or VK_FORMAT_UNDEFINED. This is
+    // useful for choosing between several encodings of the same asset, such as ASTC, BC7, ETC2.
+    static VkFormat chooseFormat(VkPhysicalDevice gpu,
+            const std::vector<VkFormat>& candidates) noexcept;
+
+    // Returns true if texels can be uploaded in the source format and converted by the GPU. The
+    // source must have 8-bit or 16-bit UNORM or SRGB channels, and the texture must have four 8-bit
+    // channels. Linear sources can be encoded as sRGB, but sRGB sources cannot be decoded.
+    static bool canConvert(VkPhysicalDevice gpu, VkFormat sourceFormat, VkFormat format) noexcept;
+
+    // Records the copy from the stage into the image. Textures are staged in a LavaStagingRing when
+    // there is one, either from the config or from LavaContext, and the ring records the copy
+    // itself, so this does nothing. Textures that do not fit in the ring get a dedicated stage.
+    // Converted textures also dispatch a compute shader, which changes the bound pipeline.
     void uploadStage(VkCommandBuffer cmd) const noexcept;
     void freeStage() noexcept;
+
+    // Uploads from a buffer owned by the caller rather than the internal stage. The buffer must
+    // contain "size" bytes at the given offset, laid out as described by the config. Textures with
+    // a "sourceFormat" cannot use this, since the conversion needs scratch space in the stage.
+    void uploadStage(VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset) const noexcept;
+
+    // Replaces a rectangle of texels in the given level and layer, leaving the rest of the image
+    // intact. Updates are gathered on the CPU until uploadUpdates, which records all of them with
+    // a single copy. Texels are tightly packed, and smaller levels are not regenerated. If the
+    // texture has a staging ring that can hold the updates, the copy is recorded by the ring and
+    // "cmd" is ignored. Otherwise the copy is recorded into "cmd" from the update stage, which is
+    // reused, so the previous uploadUpdates must have completed. Calling freeStage also releases
+    // the update stage.
+    void update(const VkRect2D& rect, uint32_t mip, uint32_t layer, void const* texels) noexcept;
+    void uploadUpdates(VkCommandBuffer cmd) noexcept;
+
     VkImageView getImageView() const noexcept;
+
+    // Returns the slot in the bindless set, or LavaBindlessSet::INVALID_INDEX if there is none.
+    uint32_t getBindlessIndex() const noexcept;
 protected:
     LavaTexture() noexcept = default;
     // par::noncopyable
@@ -0,0 +1,65 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#pragma once
+
+#include <par/LavaMemoryPool.h>
+
+#include <vulkan/vulkan.h>
+
+namespace par {
+
+// Combines many small same-format images into a single 2D array image.
+//
+// In atlas mode, items are packed into each layer with a skyline packer, otherwise each item gets
+// its own layer. Since all items share one image view, a batch of draws that use different items
+// can share a single descriptor set, selecting their item with a layer index and UV rectangle.
+//
+class LavaTextureArray {
+public:
+    struct Config {
+        VkDevice device;
+        VkPhysicalDevice gpu;
+        VkFormat format;
+        uint32_t texelSize;  // bytes per texel, compressed formats are not supported
+        uint32_t width;      // dimensions of each layer
+        uint32_t height;
+        bool atlas;          // if true, packs several items into each layer
+        uint32_t padding;    // texels between packed items, to avoid bleeding when filtering
+        LavaMemoryPool pool;
+    };
+    struct Item {
+        uint32_t layer;
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+        float uvRect[4];     // left, top, right, bottom in normalized texture coordinates
+    };
+    static LavaTextureArray* create(Config config) noexcept;
+    static void operator delete(void* );
+
+    // Finds room for an image and copies its tightly packed texels. Returns the index of the new
+    // item, or -1 if the image is larger than a layer or if the array has already been uploaded.
+    int32_t add(uint32_t width, uint32_t height, void const* texels) noexcept;
+
+    // Creates the image with as many layers as needed, then records a single buffer-to-image copy
+    // with one region per item, followed by a transition to a shader-readable layout.
+    void uploadStage(VkCommandBuffer cmd) noexcept;
+    void freeStage() noexcept;
+
+    const Item& getItem(uint32_t index) const noexcept;
+    uint32_t getItemCount() const noexcept;
+    uint32_t getLayerCount() const noexcept;
+
+    // These return null until uploadStage has been called.
+    VkImage getImage() const noexcept;
+    VkImageView getImageView() const noexcept;
+protected:
+    LavaTextureArray() noexcept = default;
+    // par::noncopyable
+    LavaTextureArray(LavaTextureArray const&) = delete;
+    LavaTextureArray& operator=(LavaTextureArray const&) = delete;
+};
+
+}
@@ -0,0 +1,73 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#pragma once
+
+#include <functional>
+
+#include <vulkan/vulkan.h>
+
+namespace par {
+
+class LavaTexture;
+
+// Decodes images on a pool of worker threads and uploads them to the GPU in batches.
+//
+// Each worker decodes directly into mapped staging memory. Once per frame, update() gathers every
+// image that has finished decoding, records their uploads into a single command buffer, and
+// submits it with a fence. Textures become available when their fence signals, so loading never
+// stalls the frame. The loader owns the textures that it creates.
+//
+class LavaTextureLoader {
+public:
+    struct Config {
+        VkDevice device;
+        VkPhysicalDevice gpu;
+        VkQueue queue;
+        uint32_t queueFamily;
+        uint32_t threadCount;   // defaults to the number of hardware threads minus one
+        VkDeviceSize stagingBudget; // decoders wait when staging memory exceeds this, 0 = no limit
+    };
+    struct ImageInfo {
+        uint32_t width;
+        uint32_t height;
+        VkFormat format;
+        uint32_t size;          // total size of the texels in bytes
+        bool mipmaps;
+    };
+    using Handle = uint32_t;
+
+    // Runs on a worker thread. The decoder should call "allocate" once it knows the dimensions of
+    // the image, then write tightly packed texels to the returned pointer. Returns false if the
+    // image could not be decoded.
+    using Allocator = std::function<uint8_t*(const ImageInfo&)>;
+    using Decoder = std::function<bool(const Allocator& allocate)>;
+
+    static LavaTextureLoader* create(Config config) noexcept;
+    static void operator delete(void* );
+
+    // Queues an image for decoding and returns immediately.
+    Handle load(Decoder decoder) noexcept;
+
+    // Submits uploads for images that have finished decoding, and publishes the textures whose
+    // uploads have completed. Call this from the thread that submits to the queue, once per frame.
+    void update() noexcept;
+
+    // Returns null until the texture has been uploaded, or if decoding failed.
+    LavaTexture* getTexture(Handle handle) const noexcept;
+    bool isReady(Handle handle) const noexcept;
+    bool hasFailed(Handle handle) const noexcept;
+
+    // Destroys the texture, which must no longer be in use by the GPU.
+    void unload(Handle handle) noexcept;
+
+    // Blocks until every queued image has been decoded and uploaded.
+    void finish() noexcept;
+protected:
+    LavaTextureLoader() noexcept = default;
+    // par::noncopyable
+    LavaTextureLoader(LavaTextureLoader const&) = delete;
+    LavaTextureLoader& operator=(LavaTextureLoader const&) = delete;
+};
+
+}
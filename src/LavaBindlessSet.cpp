@@ -0,0 +1,177 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#include <par/LavaLoader.h>
+#include <par/LavaBindlessSet.h>
+#include <par/LavaLog.h>
+
+#include <mutex>
+#include <vector>
+
+#include "LavaInternal.h"
+
+using namespace par;
+using namespace std;
+
+namespace {
+
+constexpr uint32_t DEFAULT_CAPACITY = 4096;
+
+struct LavaBindlessSetImpl : LavaBindlessSet {
+    ~LavaBindlessSetImpl() noexcept;
+    void writeImage(uint32_t index, VkImageView view, VkImageLayout layout) noexcept;
+    VkDevice device;
+    uint32_t capacity;
+    VkDescriptorSetLayout layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+    mutable mutex indexMutex;
+    vector<uint32_t> freeIndices;
+    uint32_t nextIndex = 0;
+    uint32_t imageCount = 0;
+};
+
+LAVA_DEFINE_UPCAST(LavaBindlessSet)
+
+} // anonymous namespace
+
+LavaBindlessSet* LavaBindlessSet::create(Config config) noexcept {
+    assert(config.device);
+    if (!hasDeviceExtension(config.device, LAVA_DEVICE_EXT_DESCRIPTOR_INDEXING)) {
+        llog.warn("Bindless sets require {}.", VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        return nullptr;
+    }
+    auto impl = new LavaBindlessSetImpl;
+    impl->device = config.device;
+    impl->capacity = config.capacity ? config.capacity : DEFAULT_CAPACITY;
+
+    // Slots that have never been written, or whose image has been destroyed, are simply never
+    // indexed by shaders. Partial binding makes this legal.
+    const VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+    const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+        .bindingCount = 1,
+        .pBindingFlags = &bindingFlags,
+    };
+    const VkDescriptorSetLayoutBinding binding {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        .descriptorCount = impl->capacity,
+        .stageFlags = config.stageFlags ? config.stageFlags : VK_SHADER_STAGE_ALL,
+    };
+    const VkDescriptorSetLayoutCreateInfo layoutInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &flagsInfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+    VkResult error = vkCreateDescriptorSetLayout(impl->device, &layoutInfo, VKALLOC,
+            &impl->layout);
+    LOG_CHECK(not error, "Unable to create bindless descriptor set layout.");
+
+    const VkDescriptorPoolSize poolSize {
+        .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        .descriptorCount = impl->capacity,
+    };
+    const VkDescriptorPoolCreateInfo poolInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &poolSize,
+    };
+    error = vkCreateDescriptorPool(impl->device, &poolInfo, VKALLOC, &impl->pool);
+    LOG_CHECK(not error, "Unable to create bindless descriptor pool.");
+
+    const VkDescriptorSetAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = impl->pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &impl->layout,
+    };
+    error = vkAllocateDescriptorSets(impl->device, &allocInfo, &impl->set);
+    LOG_CHECK(not error, "Unable to allocate bindless descriptor set.");
+    return impl;
+}
+
+void LavaBindlessSet::operator delete(void* ptr) {
+    auto impl = (LavaBindlessSetImpl*) ptr;
+    ::delete impl;
+}
+
+LavaBindlessSetImpl::~LavaBindlessSetImpl() noexcept {
+    vkDestroyDescriptorPool(device, pool, VKALLOC);
+    vkDestroyDescriptorSetLayout(device, layout, VKALLOC);
+}
+
+void LavaBindlessSetImpl::writeImage(uint32_t index, VkImageView view, VkImageLayout imageLayout)
+        noexcept {
+    const VkDescriptorImageInfo info {
+        .imageView = view,
+        .imageLayout = imageLayout,
+    };
+    const VkWriteDescriptorSet write {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = 0,
+        .dstArrayElement = index,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        .pImageInfo = &info,
+    };
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+VkDescriptorSetLayout LavaBindlessSet::getLayout() const noexcept {
+    return upcast(this)->layout;
+}
+
+VkDescriptorSet LavaBindlessSet::getDescriptorSet() const noexcept {
+    return upcast(this)->set;
+}
+
+uint32_t LavaBindlessSet::registerImage(VkImageView view, VkImageLayout layout) noexcept {
+    LavaBindlessSetImpl* impl = upcast(this);
+    lock_guard<mutex> lock(impl->indexMutex);
+    uint32_t index;
+    if (!impl->freeIndices.empty()) {
+        index = impl->freeIndices.back();
+        impl->freeIndices.pop_back();
+    } else if (impl->nextIndex < impl->capacity) {
+        index = impl->nextIndex++;
+    } else {
+        llog.error("Bindless set is full.");
+        return INVALID_INDEX;
+    }
+    impl->writeImage(index, view, layout);
+    impl->imageCount++;
+    return index;
+}
+
+void LavaBindlessSet::updateImage(uint32_t index, VkImageView view, VkImageLayout layout)
+        noexcept {
+    LavaBindlessSetImpl* impl = upcast(this);
+    lock_guard<mutex> lock(impl->indexMutex);
+    assert(index < impl->nextIndex);
+    impl->writeImage(index, view, layout);
+}
+
+void LavaBindlessSet::unregisterImage(uint32_t index) noexcept {
+    LavaBindlessSetImpl* impl = upcast(this);
+    if (index == INVALID_INDEX) {
+        return;
+    }
+    lock_guard<mutex> lock(impl->indexMutex);
+    assert(index < impl->nextIndex);
+    impl->freeIndices.push_back(index);
+    impl->imageCount--;
+}
+
+uint32_t LavaBindlessSet::getImageCount() const noexcept {
+    LavaBindlessSetImpl const* impl = upcast(this);
+    lock_guard<mutex> lock(impl->indexMutex);
+    return impl->imageCount;
+}
@@ -4,6 +4,7 @@
 #include <par/LavaLoader.h>
 #include <par/LavaContext.h>
 #include <par/LavaLog.h>
+#include <par/LavaStagingRing.h>
 
 #include <string>
 
@@ -43,6 +44,32 @@ static LavaVector<const char *> kValidationLayers2 {
     "VK_LAYER_GOOGLE_unique_objects"
 };
 
+// The bundled Vulkan headers predate VK_EXT_memory_budget, so we declare what we need here.
+#ifndef VK_EXT_memory_budget
+#define VK_EXT_memory_budget 1
+#define VK_EXT_MEMORY_BUDGET_EXTENSION_NAME "VK_EXT_memory_budget"
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT \
+        ((VkStructureType) 1000237000)
+typedef struct VkPhysicalDeviceMemoryBudgetPropertiesEXT {
+    VkStructureType sType;
+    void* pNext;
+    VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS];
+} VkPhysicalDeviceMemoryBudgetPropertiesEXT;
+#endif
+
+static LavaVector<const char *> kExternalMemoryInstanceExtensions {
+    VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME,
+    VK_KHR_EXTERNAL_SEMAPHORE_CAPABILITIES_EXTENSION_NAME,
+};
+
+static LavaVector<const char *> kExternalMemoryDeviceExtensions {
+    VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
+    VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+    VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME,
+    VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
+};
+
 struct SwapchainBundle {
     VkImage image;
     VkCommandBuffer cmd;
@@ -78,6 +105,7 @@ struct LavaContextImpl : LavaContext {
     VkPhysicalDeviceProperties mGpuProps;
     VkPhysicalDeviceFeatures mGpuFeatures;
     VkQueue mQueue;
+    uint32_t mQueueFamily;
     VkFormat mSwapChainFormat;
     VkColorSpaceKHR mColorSpace;
     VkPhysicalDeviceMemoryProperties mMemoryProperties;
@@ -99,6 +127,10 @@ struct LavaContextImpl : LavaContext {
     LavaRecording* mCurrentRecording {};
     VkDebugReportCallbackEXT mDebugCallback {};
     VkClearValue mClearValue {};
+    bool mHasProperties2 = false;
+    bool mHasMemoryBudget = false;
+    uint32_t mDeviceExtensions = 0;
+    LavaStagingRing* mStagingRing = nullptr;
     const Config mConfig;
 };
 
@@ -127,6 +159,7 @@ LavaContextImpl::~LavaContextImpl() noexcept {
 }
 
 static bool isExtensionSupported(const string& ext) noexcept;
+static bool isDeviceExtensionSupported(VkPhysicalDevice gpu, const string& ext) noexcept;
 static bool areAllLayersSupported(const LavaVector<VkLayerProperties>& props,
     const LavaVector<const char*>& layerNames) noexcept;
 
@@ -159,6 +192,20 @@ LavaContextImpl::LavaContextImpl(Config config) noexcept :
         llog.info("Enabling instance extension {}.", VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
         mEnabledExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
     }
+    if (isExtensionSupported(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+        llog.info("Enabling instance extension {}.",
+                VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        mEnabledExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        mHasProperties2 = true;
+    }
+    if (config.externalMemory) {
+        for (auto ext : kExternalMemoryInstanceExtensions) {
+            if (isExtensionSupported(ext)) {
+                llog.info("Enabling instance extension {}.", ext);
+                mEnabledExtensions.push_back(ext);
+            }
+        }
+    }
 
     // Create the instance.
     const VkApplicationInfo app {
@@ -182,6 +229,9 @@ LavaContextImpl::LavaContextImpl(Config config) noexcept :
 
 void LavaContextImpl::killDevice() noexcept {
     vkDeviceWaitIdle(mDevice);
+    setDefaultStagingRing(mDevice, nullptr);
+    delete mStagingRing;
+    mStagingRing = nullptr;
     destroyVma(mDevice);
     vkDestroyImageView(mDevice, mSwap[0].view, VKALLOC);
     vkDestroyImageView(mDevice, mSwap[1].view, VKALLOC);
@@ -254,6 +304,68 @@ void LavaContextImpl::initDevice(VkSurfaceKHR surface) noexcept {
     // later, so go ahead and unconditionally add it to the list.
     mEnabledExtensions.clear();
     mEnabledExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    if (mConfig.externalMemory) {
+        for (auto ext : kExternalMemoryDeviceExtensions) {
+            if (isDeviceExtensionSupported(mGpu, ext)) {
+                llog.info("Enabling device extension {}.", ext);
+                mEnabledExtensions.push_back(ext);
+            } else {
+                llog.warn("Device extension {} is not supported.", ext);
+            }
+        }
+        // Shared images are bound to dedicated allocations where VK_KHR_dedicated_allocation,
+        // which depends on VK_KHR_get_memory_requirements2, is available.
+        const char* dedicatedAllocation = VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME;
+        const char* memoryRequirements2 = VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME;
+        if (isDeviceExtensionSupported(mGpu, dedicatedAllocation) &&
+                isDeviceExtensionSupported(mGpu, memoryRequirements2)) {
+            llog.info("Enabling device extension {}.", dedicatedAllocation);
+            mEnabledExtensions.push_back(memoryRequirements2);
+            mEnabledExtensions.push_back(dedicatedAllocation);
+            mDeviceExtensions |= LAVA_DEVICE_EXT_DEDICATED_ALLOCATION;
+        }
+    }
+    if (mHasProperties2 && isDeviceExtensionSupported(mGpu, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+        llog.info("Enabling device extension {}.", VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        mEnabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        mHasMemoryBudget = true;
+    }
+    if (isDeviceExtensionSupported(mGpu, VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME)) {
+        llog.info("Enabling {}.", VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+        mEnabledExtensions.push_back(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+        mDeviceExtensions |= LAVA_DEVICE_EXT_DESCRIPTOR_UPDATE_TEMPLATE;
+    }
+    // VK_KHR_push_descriptor depends on VK_KHR_get_physical_device_properties2.
+    const char* pushDescriptor = VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME;
+    if (mHasProperties2 && isDeviceExtensionSupported(mGpu, pushDescriptor)) {
+        llog.info("Enabling device extension {}.", pushDescriptor);
+        mEnabledExtensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+        mDeviceExtensions |= LAVA_DEVICE_EXT_PUSH_DESCRIPTOR;
+    }
+
+    // Bindless textures need a partially bound, update-after-bind array of sampled images.
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+    };
+    const char* descriptorIndexing = VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME;
+    if (mHasProperties2 && vkGetPhysicalDeviceFeatures2KHR &&
+            isDeviceExtensionSupported(mGpu, descriptorIndexing) &&
+            isDeviceExtensionSupported(mGpu, VK_KHR_MAINTENANCE3_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2KHR features2 {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+            .pNext = &indexingFeatures,
+        };
+        vkGetPhysicalDeviceFeatures2KHR(mGpu, &features2);
+        if (indexingFeatures.descriptorBindingPartiallyBound &&
+                indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+                indexingFeatures.descriptorBindingUpdateUnusedWhilePending &&
+                indexingFeatures.runtimeDescriptorArray) {
+            llog.info("Enabling device extension {}.", descriptorIndexing);
+            mEnabledExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+            mEnabledExtensions.push_back(descriptorIndexing);
+            mDeviceExtensions |= LAVA_DEVICE_EXT_DESCRIPTOR_INDEXING;
+        }
+    }
 
     // Obtain various information about the GPU.
     vkGetPhysicalDeviceProperties(mGpu, &mGpuProps);
@@ -295,8 +407,20 @@ void LavaContextImpl::initDevice(VkSurfaceKHR surface) noexcept {
     };
     VkPhysicalDeviceFeatures features {};
     features.shaderClipDistance = mGpuFeatures.shaderClipDistance;
+    // Enable only the indexing features that LavaBindlessSet relies on.
+    const VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabledIndexing {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+        .shaderSampledImageArrayNonUniformIndexing =
+                indexingFeatures.shaderSampledImageArrayNonUniformIndexing,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+        .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+        .descriptorBindingPartiallyBound = VK_TRUE,
+        .runtimeDescriptorArray = VK_TRUE,
+    };
+    const bool hasIndexing = mDeviceExtensions & LAVA_DEVICE_EXT_DESCRIPTOR_INDEXING;
     VkDeviceCreateInfo deviceInfo {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = hasIndexing ? &enabledIndexing : nullptr,
         .queueCreateInfoCount = 1,
         .pQueueCreateInfos = &queueInfo,
         .enabledExtensionCount = mEnabledExtensions.size,
@@ -307,6 +431,7 @@ void LavaContextImpl::initDevice(VkSurfaceKHR surface) noexcept {
     LOG_CHECK(not error, "Unable to create Vulkan device.");
     vkGetPhysicalDeviceMemoryProperties(mGpu, &mMemoryProperties);
     vkGetDeviceQueue(mDevice, graphicsQueueNodeIndex, 0, &mQueue);
+    mQueueFamily = graphicsQueueNodeIndex;
 
     // Debug callbacks. This doesn't build on 32-bit Android.
     #if ULONG_MAX != UINT_MAX
@@ -331,6 +456,17 @@ void LavaContextImpl::initDevice(VkSurfaceKHR surface) noexcept {
 
     // Create the GPU memory allocator.
     createVma(mDevice, mGpu);
+    setDeviceExtensions(mDevice, mDeviceExtensions);
+
+    // Textures stage through this ring unless they are given their own. It is flushed before every
+    // submission below, so uploads are always ordered before the work that samples from them.
+    mStagingRing = LavaStagingRing::create({
+        .device = mDevice,
+        .gpu = mGpu,
+        .queue = mQueue,
+        .queueFamily = mQueueFamily,
+    });
+    setDefaultStagingRing(mDevice, mStagingRing);
 
     // Get the list of formats that are supported:
     LavaVector<VkSurfaceFormatKHR> formats;
@@ -532,6 +668,7 @@ void LavaContextImpl::endFrame() noexcept {
         .pImageIndices = &mCurrentSwapIndex,
     };
     vkEndCommandBuffer(mSwap[0].cmd);
+    mStagingRing->flush();
     vkQueueSubmit(mQueue, 1, &submitInfo, mSwap[0].fence);
     vkQueuePresentKHR(mQueue, &presentInfo);
     std::swap(mSwap[0], mSwap[1]);
@@ -821,10 +958,18 @@ const VkPhysicalDeviceFeatures& LavaContext::getGpuFeatures() const noexcept {
     return upcast(this)->mGpuFeatures;
 }
 
+LavaStagingRing* LavaContext::getStagingRing() const noexcept {
+    return upcast(this)->mStagingRing;
+}
+
 VkQueue LavaContext::getQueue() const noexcept {
     return upcast(this)->mQueue;
 }
 
+uint32_t LavaContext::getQueueFamily() const noexcept {
+    return upcast(this)->mQueueFamily;
+}
+
 VkFormat LavaContext::getFormat() const noexcept {
     return upcast(this)->mSwapChainFormat;
 }
@@ -890,6 +1035,7 @@ void LavaContext::endWork() noexcept {
         .pCommandBuffers = &impl->mWorkCmd,
     };
     vkEndCommandBuffer(impl->mWorkCmd);
+    impl->mStagingRing->flush();
     vkQueueSubmit(impl->mQueue, 1, &submitInfo, impl->mWorkFence);
 }
 
@@ -993,6 +1139,7 @@ void LavaContext::presentRecording(LavaRecording* recording) noexcept {
     VkFence fence = recording->fence[index];
     vkWaitForFences(impl->mDevice, 1, &fence, VK_TRUE, ~0ull);
     vkResetFences(impl->mDevice, 1, &fence);
+    impl->mStagingRing->flush();
     vkQueueSubmit(impl->mQueue, 1, &submitInfo, fence);
     vkQueuePresentKHR(impl->mQueue, &presentInfo);
 }
@@ -1003,13 +1150,141 @@ void LavaContext::waitRecording(LavaRecording* recording) noexcept {
     vkWaitForFences(impl->mDevice, 2, recording->fence, VK_TRUE, ~0ull);
 }
 
+VkSemaphore LavaContext::createExportableSemaphore() noexcept {
+    auto impl = upcast(this);
+    assert(impl->mConfig.externalMemory);
+    const VkExportSemaphoreCreateInfoKHR exportInfo {
+        .sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO_KHR,
+        .handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR,
+    };
+    const VkSemaphoreCreateInfo info {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &exportInfo,
+    };
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    VkResult error = vkCreateSemaphore(impl->mDevice, &info, VKALLOC, &semaphore);
+    LOG_CHECK(not error, "Unable to create exportable semaphore.");
+    return semaphore;
+}
+
+int LavaContext::exportSemaphore(VkSemaphore semaphore) noexcept {
+    auto impl = upcast(this);
+    LOG_CHECK(vkGetSemaphoreFdKHR, "VK_KHR_external_semaphore_fd is not available.");
+    const VkSemaphoreGetFdInfoKHR info {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
+        .semaphore = semaphore,
+        .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR,
+    };
+    int fd = -1;
+    if (vkGetSemaphoreFdKHR(impl->mDevice, &info, &fd) != VK_SUCCESS) {
+        llog.error("Unable to export semaphore.");
+        return -1;
+    }
+    return fd;
+}
+
+VkSemaphore LavaContext::importSemaphore(int fd) noexcept {
+    auto impl = upcast(this);
+    LOG_CHECK(vkImportSemaphoreFdKHR, "VK_KHR_external_semaphore_fd is not available.");
+    VkSemaphore semaphore = createExportableSemaphore();
+    const VkImportSemaphoreFdInfoKHR info {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR,
+        .semaphore = semaphore,
+        .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT_KHR,
+        .fd = fd,
+    };
+    VkResult error = vkImportSemaphoreFdKHR(impl->mDevice, &info);
+    LOG_CHECK(not error, "Unable to import semaphore.");
+    return semaphore;
+}
+
+LavaContext::MemoryStats LavaContext::getMemoryStats() const noexcept {
+    auto impl = upcast(this);
+    const VkPhysicalDeviceMemoryProperties& props = impl->mMemoryProperties;
+    MemoryStats stats {};
+    stats.heaps.resize(props.memoryHeapCount);
+    for (uint32_t i = 0; i < props.memoryHeapCount; ++i) {
+        stats.heaps[i].size = props.memoryHeaps[i].size;
+        stats.heaps[i].deviceLocal = props.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+    }
+    if (impl->mHasMemoryBudget && vkGetPhysicalDeviceMemoryProperties2KHR) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+        };
+        VkPhysicalDeviceMemoryProperties2KHR props2 {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR,
+            .pNext = &budget,
+        };
+        vkGetPhysicalDeviceMemoryProperties2KHR(impl->mGpu, &props2);
+        for (uint32_t i = 0; i < props.memoryHeapCount; ++i) {
+            stats.heaps[i].used = budget.heapUsage[i];
+            stats.heaps[i].budget = budget.heapBudget[i];
+        }
+        stats.driverBudget = true;
+    } else {
+        VmaStats vmaStats;
+        vmaCalculateStats(getVma(impl->mDevice, impl->mGpu), &vmaStats);
+        for (uint32_t i = 0; i < props.memoryHeapCount; ++i) {
+            const VmaStatInfo& info = vmaStats.memoryHeap[i];
+            stats.heaps[i].used = info.usedBytes + info.unusedBytes;
+            stats.heaps[i].budget = stats.heaps[i].size * 8 / 10;
+        }
+    }
+    stats.textures = getTrackedMemory(impl->mDevice, LAVA_MEMORY_TEXTURE);
+    stats.attachments = getTrackedMemory(impl->mDevice, LAVA_MEMORY_ATTACHMENT);
+    stats.cpuBuffers = getTrackedMemory(impl->mDevice, LAVA_MEMORY_CPU_BUFFER);
+    stats.gpuBuffers = getTrackedMemory(impl->mDevice, LAVA_MEMORY_GPU_BUFFER);
+    return stats;
+}
+
+string LavaContext::getMemoryStatsJson(bool detailed) const noexcept {
+    auto impl = upcast(this);
+    const MemoryStats stats = getMemoryStats();
+    string json = "{\n  \"Heaps\": [";
+    for (size_t i = 0; i < stats.heaps.size(); ++i) {
+        const MemoryHeap& heap = stats.heaps[i];
+        json += i ? ",\n" : "\n";
+        json += "    {\"Size\": " + to_string(heap.size) +
+                ", \"Used\": " + to_string(heap.used) +
+                ", \"Budget\": " + to_string(heap.budget) +
+                ", \"DeviceLocal\": " + (heap.deviceLocal ? "true" : "false") + "}";
+    }
+    json += "\n  ],\n  \"DriverBudget\": ";
+    json += stats.driverBudget ? "true" : "false";
+    json += ",\n  \"Categories\": {\"Textures\": " + to_string(stats.textures) +
+            ", \"Attachments\": " + to_string(stats.attachments) +
+            ", \"CpuBuffers\": " + to_string(stats.cpuBuffers) +
+            ", \"GpuBuffers\": " + to_string(stats.gpuBuffers) + "},\n  \"Allocator\": ";
+    VmaAllocator vma = getVma(impl->mDevice, impl->mGpu);
+    char* vmaJson = nullptr;
+    vmaBuildStatsString(vma, &vmaJson, detailed);
+    json += vmaJson;
+    vmaFreeStatsString(vma, vmaJson);
+    json += "\n}\n";
+    return json;
+}
+
 static bool isExtensionSupported(const string& ext) noexcept {
     LavaVector<VkExtensionProperties> props;
     vkEnumerateInstanceExtensionProperties(nullptr, &props.size, nullptr);
     VkResult error = vkEnumerateInstanceExtensionProperties(nullptr, &props.size, props.alloc());
     LOG_CHECK(not error, "Unable to enumerate extension properties.");
     for (auto prop : props) {
-        if (ext != prop.extensionName) {
+        if (ext == prop.extensionName) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isDeviceExtensionSupported(VkPhysicalDevice gpu, const string& ext) noexcept {
+    LavaVector<VkExtensionProperties> props;
+    vkEnumerateDeviceExtensionProperties(gpu, nullptr, &props.size, nullptr);
+    VkResult error = vkEnumerateDeviceExtensionProperties(gpu, nullptr, &props.size,
+            props.alloc());
+    LOG_CHECK(not error, "Unable to enumerate device extension properties.");
+    for (auto prop : props) {
+        if (ext == prop.extensionName) {
             return true;
         }
     }
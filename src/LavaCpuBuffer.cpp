@@ -31,6 +31,7 @@ void LavaCpuBuffer::operator delete(void* ptr) {
 }
 
 LavaCpuBufferImpl::~LavaCpuBufferImpl() noexcept {
+    trackMemory(device, LAVA_MEMORY_CPU_BUFFER, -(int64_t) getAllocationSize(vma, memory));
     vmaDestroyBuffer(vma, buffer, memory);
 }
 
@@ -43,8 +44,20 @@ LavaCpuBufferImpl::LavaCpuBufferImpl(Config config) noexcept : device(config.dev
         .usage = config.usage
     };
     size = config.size;
+    LavaMemoryPool pool = config.pool;
+    if (pool == LavaMemoryPool::AUTO) {
+        if (config.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
+            pool = LavaMemoryPool::UNIFORM;
+        } else if (config.usage & (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                VK_BUFFER_USAGE_INDEX_BUFFER_BIT)) {
+            pool = LavaMemoryPool::GEOMETRY;
+        } else {
+            pool = LavaMemoryPool::STAGING;
+        }
+    }
     VmaAllocationCreateInfo allocInfo { .usage = VMA_MEMORY_USAGE_CPU_TO_GPU };
-    vmaCreateBuffer(vma, &bufferInfo, &allocInfo, &buffer, &memory, nullptr);
+    createPooledBuffer(device, vma, pool, bufferInfo, &allocInfo, &buffer, &memory);
+    trackMemory(device, LAVA_MEMORY_CPU_BUFFER, getAllocationSize(vma, memory));
     if (config.source) {
         setData(config.source, config.size);
     }
@@ -0,0 +1,165 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#include <par/LavaLoader.h>
+#include <par/LavaDefragmenter.h>
+#include <par/LavaDescCache.h>
+#include <par/LavaLog.h>
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <unordered_map>
+
+#include "LavaInternal.h"
+
+using namespace par;
+using namespace std;
+
+namespace {
+
+constexpr uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+struct MemoryBlock {
+    VmaPool pool;
+    uint32_t memoryType;
+    VkDeviceSize used;
+    vector<LavaMovable*> movables;
+};
+
+struct LavaDefragmenterImpl : LavaDefragmenter {
+    ~LavaDefragmenterImpl() noexcept;
+    void destroyGarbage(const LavaRelocation& garbage) noexcept;
+    VkDeviceMemory chooseBlock() noexcept;
+    VkDevice device;
+    VmaAllocator vma;
+    vector<LavaDescCache*> descCaches;
+    uint32_t framesInFlight;
+    deque<LavaRelocation> garbage;
+    unordered_map<VkDeviceMemory, MemoryBlock> blocks;
+    Stats stats {};
+};
+
+LAVA_DEFINE_UPCAST(LavaDefragmenter)
+
+} // anonymous namespace
+
+LavaDefragmenter* LavaDefragmenter::create(Config config) noexcept {
+    assert(config.device && config.gpu);
+    auto impl = new LavaDefragmenterImpl;
+    impl->device = config.device;
+    impl->vma = getVma(config.device, config.gpu);
+    impl->descCaches = config.descCaches;
+    impl->framesInFlight = config.framesInFlight ? config.framesInFlight :
+            DEFAULT_FRAMES_IN_FLIGHT;
+    return impl;
+}
+
+void LavaDefragmenter::operator delete(void* ptr) {
+    auto impl = (LavaDefragmenterImpl*) ptr;
+    ::delete impl;
+}
+
+LavaDefragmenterImpl::~LavaDefragmenterImpl() noexcept {
+    for (const auto& relocation : garbage) {
+        destroyGarbage(relocation);
+    }
+}
+
+void LavaDefragmenterImpl::destroyGarbage(const LavaRelocation& relocation) noexcept {
+    for (VkFramebuffer framebuffer : relocation.framebuffers) {
+        vkDestroyFramebuffer(device, framebuffer, VKALLOC);
+    }
+    for (VkImageView view : relocation.views) {
+        vkDestroyImageView(device, view, VKALLOC);
+    }
+    for (const auto& pair : relocation.images) {
+        vmaDestroyImage(vma, pair.first, pair.second);
+    }
+    for (const auto& pair : relocation.buffers) {
+        vmaDestroyBuffer(vma, pair.first, pair.second);
+    }
+}
+
+// Groups all movable allocations by their VkDeviceMemory and returns the least-occupied block,
+// considering only pools that have at least two blocks (otherwise there is nowhere to go). Blocks
+// are counted per pool because relocated allocations never leave the pool they were created in.
+VkDeviceMemory LavaDefragmenterImpl::chooseBlock() noexcept {
+    blocks.clear();
+    map<pair<VmaPool, uint32_t>, uint32_t> blocksPerPool;
+    forEachMovable(device, [this, &blocksPerPool] (LavaMovable* movable) {
+        VmaAllocationInfo info;
+        vmaGetAllocationInfo(vma, *movable->allocation, &info);
+        auto iter = blocks.find(info.deviceMemory);
+        if (iter == blocks.end()) {
+            iter = blocks.emplace(info.deviceMemory,
+                    MemoryBlock {movable->pool, info.memoryType, 0}).first;
+            ++blocksPerPool[{movable->pool, info.memoryType}];
+        }
+        iter->second.used += info.size;
+        iter->second.movables.push_back(movable);
+    });
+    VkDeviceMemory result = VK_NULL_HANDLE;
+    VkDeviceSize smallest = ~VkDeviceSize(0);
+    for (const auto& pair : blocks) {
+        const MemoryBlock& block = pair.second;
+        if (blocksPerPool[{block.pool, block.memoryType}] > 1 && block.used < smallest) {
+            smallest = block.used;
+            result = pair.first;
+        }
+    }
+    return result;
+}
+
+uint32_t LavaDefragmenter::step(VkCommandBuffer cmd, uint64_t budgetMicroseconds) noexcept {
+    LavaDefragmenterImpl* impl = upcast(this);
+    auto start = chrono::steady_clock::now();
+    auto budget = chrono::microseconds(budgetMicroseconds);
+
+    // Destroy resources that were replaced long enough ago that the GPU no longer uses them.
+    auto& garbage = impl->garbage;
+    while (garbage.size() >= impl->framesInFlight) {
+        impl->destroyGarbage(garbage.front());
+        garbage.pop_front();
+    }
+    garbage.emplace_back();
+    LavaRelocation& reloc = garbage.back();
+    reloc.cmd = cmd;
+    reloc.sourceMemory = impl->chooseBlock();
+    if (!reloc.sourceMemory) {
+        return 0;
+    }
+
+    uint32_t moved = 0;
+    for (LavaMovable* movable : impl->blocks[reloc.sourceMemory].movables) {
+        if (chrono::steady_clock::now() - start > budget) {
+            break;
+        }
+        // The movable may have been destroyed since the block was chosen, which the registry
+        // detects while preventing it from being destroyed during the move.
+        VkDeviceSize size = 0;
+        reloc.oldBuffer = reloc.newBuffer = VK_NULL_HANDLE;
+        reloc.oldView = reloc.newView = VK_NULL_HANDLE;
+        if (!relocateMovable(impl->device, movable, &reloc, &size)) {
+            impl->stats.failedMoves++;
+            continue;
+        }
+        for (LavaDescCache* cache : impl->descCaches) {
+            if (reloc.oldBuffer) {
+                cache->unsetUniformBuffer(reloc.oldBuffer);
+                cache->unsetStorageBuffer(reloc.oldBuffer);
+            }
+            if (reloc.oldView) {
+                cache->unsetImageView(reloc.oldView);
+            }
+        }
+        impl->stats.movedAllocations++;
+        impl->stats.movedBytes += size;
+        ++moved;
+    }
+    return moved;
+}
+
+const LavaDefragmenter::Stats& LavaDefragmenter::getStats() const noexcept {
+    return upcast(this)->stats;
+}
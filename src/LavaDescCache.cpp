@@ -16,19 +16,39 @@ using namespace std;
 namespace par {
 namespace {
 
-// Maximum number of descriptor sets that can be allocated in each descriptor pool.
-constexpr uint32_t MAX_NUM_DESCRIPTORS = 1000;
+// Number of descriptor sets in the first descriptor pool. Each subsequent pool is twice as large
+// as its predecessor, so the number of pools grows logarithmically with the number of sets.
+constexpr uint32_t INITIAL_POOL_CAPACITY = 64;
+
+// Maximum number of bindings in a layout, which lets cache keys live inline.
+constexpr uint32_t MAX_NUM_BINDINGS = 16;
+
+// Holds the state of a single binding, laid out exactly like the info struct that Vulkan expects
+// for its descriptor type. Unused bytes are always zero, so records can be hashed and compared as
+// raw words. A record of all zeros denotes an unset binding.
+union BindingRecord {
+    VkDescriptorBufferInfo buffer;
+    VkDescriptorImageInfo image;
+    VkBufferView texelBuffer;
+    uint32_t words[6];
+};
+
+static_assert(sizeof(BindingRecord) == sizeof(BindingRecord::words), "Unexpected record size.");
 
+// The hash is the XOR of the per-binding hashes, which allows it to be updated incrementally as
+// individual bindings change, rather than rehashing the entire key on every lookup.
 struct CacheKey {
-    vector<VkBuffer> uniformBuffers;
-    vector<VkDescriptorImageInfo> imageSamplers;
-    vector<VkDescriptorImageInfo> inputAttachments;
+    BindingRecord bindings[MAX_NUM_BINDINGS];
+    uint32_t count;
+    uint32_t hash;
 };
 
-struct CacheVal {
+struct CacheVal : LavaLruNode {
+    CacheVal() noexcept = default;
+    CacheVal(VkDescriptorSet handle, VkDescriptorPool pool) noexcept : handle(handle), pool(pool) {}
     VkDescriptorSet handle;
-    uint64_t timestampMs;
-    uint64_t timestampFrame;
+    VkDescriptorPool pool;
+    const CacheKey* key = nullptr;
     // move-only (disallow copy) to allow keeping a pointer to a value in the map.
     CacheVal(CacheVal const&) = delete;
     CacheVal& operator=(CacheVal const&) = delete;
@@ -36,103 +56,135 @@ struct CacheVal {
     CacheVal& operator=(CacheVal &&) = default;
 };
 
+struct DescriptorPool {
+    VkDescriptorPool handle;
+    uint32_t capacity;
+    uint32_t liveCount;
+};
+
+// Pools for one frame in flight in transient mode. Sets are bump-allocated from the active pool,
+// then released all at once by resetting every pool when the frame slot comes around again.
+struct TransientFrame {
+    vector<DescriptorPool> pools;
+    uint32_t active;
+};
+
 struct IsEqual {
-    bool operator()(const VkDescriptorImageInfo& a, const VkDescriptorImageInfo& b) const {
-        return a.sampler == b.sampler && a.imageView == b.imageView &&
-                a.imageLayout == b.imageLayout;
-    }
     bool operator()(const CacheKey& a, const CacheKey& b) const {
-        if (a.uniformBuffers.size() != b.uniformBuffers.size()) {
-            return false;
-        }
-        for (size_t i = 0; i < a.uniformBuffers.size(); ++i) {
-            if (a.uniformBuffers[i] != b.uniformBuffers[i]) {
-                return false;
-            }
-        }
-        if (a.imageSamplers.size() != b.imageSamplers.size()) {
-            return false;
-        }
-        for (size_t i = 0; i < a.imageSamplers.size(); ++i) {
-            if (!(*this)(a.imageSamplers[i], b.imageSamplers[i])) {
-                return false;
-            }
-        }
-        if (a.inputAttachments.size() != b.inputAttachments.size()) {
-            return false;
-        }
-        for (size_t i = 0; i < a.inputAttachments.size(); ++i) {
-            if (!(*this)(a.inputAttachments[i], b.inputAttachments[i])) {
-                return false;
-            }
-        }
-        return true;
+        return a.hash == b.hash && a.count == b.count &&
+                0 == memcmp(a.bindings, b.bindings, a.count * sizeof(BindingRecord));
     }
 };
 
 struct HashFn {
-    uint64_t operator()(const CacheKey& key) const {
-        assert(sizeof(VkBuffer) == 8);
-        assert(sizeof(VkSampler) == 8);
-        assert(sizeof(VkImageView) == 8);
-        assert(sizeof(VkImageLayout) == 4);
-        static std::vector<uint32_t> src;
-        src.clear();
-        src.reserve(2 * key.uniformBuffers.size() + 5 * key.imageSamplers.size() +
-            5 * key.inputAttachments.size());
-        for (const auto& ub : key.uniformBuffers) {
-            auto p = (uint32_t*) &ub;
-            src.push_back(*p++);
-            src.push_back(*p++);
-        }
-        for (const auto& is : key.imageSamplers) {
-            auto p = (uint32_t*) &is;
-            src.push_back(*p++);
-            src.push_back(*p++);
-            src.push_back(*p++);
-            src.push_back(*p++);
-            src.push_back(*p++);
-        }
-        for (const auto& ia : key.inputAttachments) {
-            auto p = (uint32_t*) &ia;
-            src.push_back(*p++);
-            src.push_back(*p++);
-            src.push_back(*p++);
-            src.push_back(*p++);
-            src.push_back(*p++);
-        }
-        if (src.empty()) {
-            return 0;
-        }
-        return murmurHash(src.data(), src.size(), 0);
+    uint32_t operator()(const CacheKey& key) const {
+        return key.hash;
     }
 };
 
-using Cache = unordered_map<CacheKey, CacheVal, HashFn, IsEqual>;
+BindingRecord makeRecord(VkBuffer buffer) {
+    BindingRecord record {};
+    if (buffer) {
+        record.buffer = { .buffer = buffer, .offset = 0, .range = VK_WHOLE_SIZE };
+    }
+    return record;
+}
+
+BindingRecord makeRecord(const VkDescriptorBufferInfo& info) {
+    BindingRecord record {};
+    if (info.buffer) {
+        record.buffer = info;
+    }
+    return record;
+}
+
+BindingRecord makeRecord(VkBufferView view) {
+    BindingRecord record {};
+    record.texelBuffer = view;
+    return record;
+}
 
-namespace DirtyFlag {
-    static constexpr uint8_t UNIFORM_BUFFER = 1 << 0; 
-    static constexpr uint8_t IMAGE_SAMPLER = 1 << 1;
-    static constexpr uint8_t INPUT_ATTACHMENT = 1 << 2;
+BindingRecord makeRecord(const VkDescriptorImageInfo& info) {
+    BindingRecord record {};
+    record.image.sampler = info.sampler;
+    record.image.imageView = info.imageView;
+    record.image.imageLayout = info.imageLayout;
+    return record;
 }
 
+bool isUniformType(VkDescriptorType type) {
+    return type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ||
+            type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+}
+
+bool isBufferType(VkDescriptorType type) {
+    return isUniformType(type) || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+}
+
+bool isTexelType(VkDescriptorType type) {
+    return type == VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER ||
+            type == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
+}
+
+bool isImageType(VkDescriptorType type) {
+    return !isBufferType(type) && !isTexelType(type);
+}
+
+bool isUnset(const BindingRecord& record) {
+    for (uint32_t word : record.words) {
+        if (word) {
+            return false;
+        }
+    }
+    return true;
+}
+
+using Cache = unordered_map<CacheKey, CacheVal, HashFn, IsEqual,
+        LavaNodeAllocator<pair<const CacheKey, CacheVal>>>;
+
 struct LavaDescCacheImpl : LavaDescCache {
     ~LavaDescCacheImpl() noexcept;
+    void setBinding(uint32_t index, const BindingRecord& record) noexcept;
+    bool hasBindingType(uint32_t index, VkDescriptorType type) const noexcept {
+        return index < currentState.count && bindingTypes[index] == type;
+    }
+    void unsetBindings(function<bool(const BindingRecord&, VkDescriptorType)> match) noexcept;
+    DescriptorPool createPool(uint32_t capacity, VkDescriptorPoolCreateFlags flags) noexcept;
+    void allocateSet(VkDescriptorSet* set, VkDescriptorPool* pool) noexcept;
+    void allocateTransientSet(VkDescriptorSet* set) noexcept;
+    void freeSet(VkDescriptorSet set, VkDescriptorPool pool) noexcept;
+    void graveSet(const CacheVal& val) noexcept;
+    void reserveEntries() noexcept;
+    void touch(CacheVal* val) noexcept;
+    uint32_t buildWrites(VkDescriptorSet set, const CacheKey& key) noexcept;
+    bool writeSet(VkDescriptorSet set, const CacheKey& key,
+            vector<VkWriteDescriptorSet>* clientWrites) noexcept;
     CacheVal* currentDescriptor = nullptr;
     VkDevice device;
-    Cache cache;
+    LavaNodePool nodePool;
+    Cache cache { 0, HashFn(), IsEqual(), &nodePool };
+    size_t reservedEntries = 0;
     CacheKey currentState;
+    uint32_t bindingHashes[MAX_NUM_BINDINGS];
+    VkDescriptorType bindingTypes[MAX_NUM_BINDINGS];
     std::vector<CacheVal> graveyard;
-    uint8_t dirtyFlags = 0xf;
+    bool dirty = true;
+    bool offsetsDirty = false;
+    bool pushDescriptors = false;
     VkDescriptorSetLayout layout;
-    VkDescriptorPool descriptorPool;
+    VkDescriptorUpdateTemplateKHR updateTemplate = VK_NULL_HANDLE;
+    vector<DescriptorPool> pools;
+    vector<VkDescriptorPoolSize> setSizes;
+    vector<TransientFrame> transientFrames;
+    uint32_t transientIndex = 0;
+    CacheVal transientVal {};
     uint32_t numUniformBuffers;
+    uint32_t numDynamicBuffers;
     uint32_t numImageSamplers;
-    uint32_t numInputAttachments;
-    uint64_t currentFrame = 0;
-    std::vector<VkWriteDescriptorSet> writes;
-    std::vector<VkDescriptorBufferInfo> bufferWrites;
-    std::vector<VkDescriptorImageInfo> imageWrites;
+    LavaCacheClock clock;
+    LavaLruList lru;
+    VkWriteDescriptorSet writes[MAX_NUM_BINDINGS];
+    uint32_t dynamicOffsets[MAX_NUM_BINDINGS] = {};
 };
 
 LAVA_DEFINE_UPCAST(LavaDescCache)
@@ -143,92 +195,341 @@ LavaDescCache* LavaDescCache::create(Config config) noexcept {
     assert(config.device);
     auto impl = new LavaDescCacheImpl;
     impl->device = config.device;
-    impl->currentState = {
-        .uniformBuffers = config.uniformBuffers,
-        .imageSamplers = config.imageSamplers,
-        .inputAttachments = config.inputAttachments,
-    };
     impl->numUniformBuffers = (uint32_t) config.uniformBuffers.size();
+    impl->numDynamicBuffers = (uint32_t) config.dynamicUniformBuffers.size();
     impl->numImageSamplers = (uint32_t) config.imageSamplers.size();
-    impl->numInputAttachments = (uint32_t) config.inputAttachments.size();
-    impl->bufferWrites.resize(impl->numUniformBuffers);
-    impl->imageWrites.resize(impl->numImageSamplers + impl->numInputAttachments);
-    impl->writes.resize(impl->bufferWrites.size() + impl->imageWrites.size());
-
-    vector<VkDescriptorSetLayoutBinding> bindings;
-    bindings.reserve(impl->writes.size());
+    const uint32_t numBindings = impl->numUniformBuffers + impl->numDynamicBuffers +
+            impl->numImageSamplers + (uint32_t) config.inputAttachments.size() +
+            (uint32_t) config.storageBuffers.size() + (uint32_t) config.storageImages.size() +
+            (uint32_t) config.uniformTexelBuffers.size() +
+            (uint32_t) config.storageTexelBuffers.size();
+    LOG_CHECK(numBindings <= MAX_NUM_BINDINGS, "Too many descriptor bindings.");
+
+    CacheKey& key = impl->currentState;
+    key = {};
+    key.count = numBindings;
     uint32_t binding = 0;
-    for (auto dummy LAVA_UNUSED : config.uniformBuffers) {
-        bindings.emplace_back(VkDescriptorSetLayoutBinding {
-            .binding = binding++,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_ALL,
-        });
+    for (VkBuffer buffer : config.uniformBuffers) {
+        impl->bindingTypes[binding] = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        key.bindings[binding++] = makeRecord(buffer);
     }
-    for (auto dummy LAVA_UNUSED : config.imageSamplers) {
-        bindings.emplace_back(VkDescriptorSetLayoutBinding {
-            .binding = binding++,
-            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_ALL,
-        });
+    for (const auto& info : config.dynamicUniformBuffers) {
+        LOG_CHECK(info.range != VK_WHOLE_SIZE, "Dynamic uniform buffers require a range.");
+        impl->bindingTypes[binding] = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        key.bindings[binding++] = makeRecord(info);
+    }
+    for (const auto& info : config.imageSamplers) {
+        impl->bindingTypes[binding] = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        key.bindings[binding++] = makeRecord(info);
+    }
+    for (const auto& info : config.inputAttachments) {
+        impl->bindingTypes[binding] = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+        key.bindings[binding++] = makeRecord(info);
+    }
+    for (const auto& info : config.storageBuffers) {
+        impl->bindingTypes[binding] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        key.bindings[binding++] = makeRecord(info);
+    }
+    for (const auto& info : config.storageImages) {
+        impl->bindingTypes[binding] = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        key.bindings[binding++] = makeRecord(info);
     }
-    for (auto dummy LAVA_UNUSED : config.inputAttachments) {
-        bindings.emplace_back(VkDescriptorSetLayoutBinding {
-            .binding = binding++,
-            .descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+    for (VkBufferView view : config.uniformTexelBuffers) {
+        impl->bindingTypes[binding] = VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+        key.bindings[binding++] = makeRecord(view);
+    }
+    for (VkBufferView view : config.storageTexelBuffers) {
+        impl->bindingTypes[binding] = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
+        key.bindings[binding++] = makeRecord(view);
+    }
+    for (uint32_t i = 0; i < numBindings; ++i) {
+        impl->bindingHashes[i] = murmurHash(key.bindings[i].words, 6, i);
+        key.hash ^= impl->bindingHashes[i];
+    }
+
+    // Push descriptor layouts cannot contain dynamic buffers, so those fall back to the cache.
+    if (config.pushDescriptors) {
+        impl->pushDescriptors = hasDeviceExtension(impl->device, LAVA_DEVICE_EXT_PUSH_DESCRIPTOR) &&
+                vkCmdPushDescriptorSetKHR && impl->numDynamicBuffers == 0;
+        if (!impl->pushDescriptors) {
+            llog.warn("Push descriptors are unavailable, falling back to cached sets.");
+        }
+    }
+
+    // Narrow stage masks let some drivers skip work for stages that never see the binding.
+    LOG_CHECK(config.stageFlags.size() <= numBindings, "Too many stage flags.");
+    vector<VkDescriptorSetLayoutBinding> bindings(numBindings);
+    for (uint32_t i = 0; i < numBindings; ++i) {
+        const VkDescriptorType type = impl->bindingTypes[i];
+        VkShaderStageFlags stages = type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT ?
+                VK_SHADER_STAGE_FRAGMENT_BIT : VK_SHADER_STAGE_ALL;
+        if (i < config.stageFlags.size() && config.stageFlags[i]) {
+            stages = config.stageFlags[i];
+        }
+        bindings[i] = {
+            .binding = i,
+            .descriptorType = type,
             .descriptorCount = 1,
-            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-        });
+            .stageFlags = stages,
+        };
     }
 
     VkDescriptorSetLayoutCreateInfo info {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = impl->pushDescriptors ?
+                VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0u,
         .bindingCount = (uint32_t) bindings.size(),
         .pBindings = bindings.data()
     };
-    vkCreateDescriptorSetLayout(impl->device, &info, VKALLOC, &impl->layout);
+    impl->layout = acquireSetLayout(impl->device, info);
+
+    // If possible, create an update template that reads the records straight out of a cache key,
+    // which is much cheaper than building a list of writes for every cache miss.
+    if (hasDeviceExtension(impl->device, LAVA_DEVICE_EXT_DESCRIPTOR_UPDATE_TEMPLATE) &&
+            vkCreateDescriptorUpdateTemplateKHR && numBindings > 0 && !impl->pushDescriptors) {
+        VkDescriptorUpdateTemplateEntryKHR entries[MAX_NUM_BINDINGS];
+        for (uint32_t i = 0; i < numBindings; ++i) {
+            entries[i] = {
+                .dstBinding = i,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = impl->bindingTypes[i],
+                .offset = i * sizeof(BindingRecord),
+                .stride = sizeof(BindingRecord),
+            };
+        }
+        VkDescriptorUpdateTemplateCreateInfoKHR templateInfo {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR,
+            .descriptorUpdateEntryCount = numBindings,
+            .pDescriptorUpdateEntries = entries,
+            .templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR,
+            .descriptorSetLayout = impl->layout,
+        };
+        VkResult error = vkCreateDescriptorUpdateTemplateKHR(impl->device, &templateInfo, VKALLOC,
+                &impl->updateTemplate);
+        if (error) {
+            llog.warn("Unable to create descriptor update template.");
+            impl->updateTemplate = VK_NULL_HANDLE;
+        }
+    }
+
+    // Count the descriptors of each type in a single set, which determines the pool sizes.
+    for (uint32_t i = 0; i < numBindings; ++i) {
+        auto& sizes = impl->setSizes;
+        auto iter = sizes.begin();
+        while (iter != sizes.end() && iter->type != impl->bindingTypes[i]) {
+            ++iter;
+        }
+        if (iter == sizes.end()) {
+            sizes.push_back({ .type = impl->bindingTypes[i], .descriptorCount = 0 });
+            iter = sizes.end() - 1;
+        }
+        iter->descriptorCount++;
+    }
+    assert(!impl->setSizes.empty());
+    impl->transientFrames.resize(config.transientFrames);
+    for (auto& frame : impl->transientFrames) {
+        frame.active = 0;
+    }
+    return impl;
+}
+
+void LavaDescCache::operator delete(void* ptr) {
+    auto impl = (LavaDescCacheImpl*) ptr;
+    ::delete impl;
+}
+
+LavaDescCacheImpl::~LavaDescCacheImpl() noexcept {
+    for (auto& pool : pools) {
+        vkDestroyDescriptorPool(device, pool.handle, VKALLOC);
+    }
+    for (auto& frame : transientFrames) {
+        for (auto& pool : frame.pools) {
+            vkDestroyDescriptorPool(device, pool.handle, VKALLOC);
+        }
+    }
+    if (updateTemplate) {
+        vkDestroyDescriptorUpdateTemplateKHR(device, updateTemplate, VKALLOC);
+    }
+    releaseSetLayout(device, layout);
+}
+
+// Allocates from the newest pool that has room, falling back to older pools in case the newest one
+// is fragmented. When every pool is exhausted, appends a new pool that is twice as large as the
+// largest existing pool.
+void LavaDescCacheImpl::allocateSet(VkDescriptorSet* set, VkDescriptorPool* pool) noexcept {
+    VkDescriptorSetAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout
+    };
+    for (auto iter = pools.rbegin(); iter != pools.rend(); ++iter) {
+        if (iter->liveCount == iter->capacity) {
+            continue;
+        }
+        allocInfo.descriptorPool = iter->handle;
+        VkResult result = vkAllocateDescriptorSets(device, &allocInfo, set);
+        if (result == VK_SUCCESS) {
+            iter->liveCount++;
+            *pool = iter->handle;
+            return;
+        }
+        LOG_CHECK(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL,
+                "Unable to allocate descriptor set.");
+    }
+    uint32_t capacity = INITIAL_POOL_CAPACITY;
+    for (const auto& existing : pools) {
+        capacity = std::max(capacity, existing.capacity * 2);
+    }
+    const auto flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    DescriptorPool newPool = createPool(capacity, flags);
+    allocInfo.descriptorPool = newPool.handle;
+    VkResult error = vkAllocateDescriptorSets(device, &allocInfo, set);
+    LOG_CHECK(not error, "Unable to allocate descriptor set.");
+    newPool.liveCount = 1;
+    pools.push_back(newPool);
+    *pool = newPool.handle;
+}
 
-    VkDescriptorPoolSize poolSizes[3] = {};
+DescriptorPool LavaDescCacheImpl::createPool(uint32_t capacity, VkDescriptorPoolCreateFlags flags)
+        noexcept {
+    VkDescriptorPoolSize poolSizes[MAX_NUM_BINDINGS];
+    for (size_t i = 0; i < setSizes.size(); ++i) {
+        poolSizes[i] = setSizes[i];
+        poolSizes[i].descriptorCount *= capacity;
+    }
     VkDescriptorPoolCreateInfo poolInfo {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .poolSizeCount = (uint32_t) setSizes.size(),
         .pPoolSizes = poolSizes,
-        .maxSets = MAX_NUM_DESCRIPTORS,
-        .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT
+        .maxSets = capacity,
+        .flags = flags
     };
-    if (impl->numUniformBuffers > 0) {
-        VkDescriptorPoolSize* size = &poolSizes[poolInfo.poolSizeCount++];
-        size->type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        size->descriptorCount = poolInfo.maxSets * impl->numUniformBuffers;
+    DescriptorPool pool { .capacity = capacity, .liveCount = 0 };
+    VkResult error = vkCreateDescriptorPool(device, &poolInfo, VKALLOC, &pool.handle);
+    LOG_CHECK(not error, "Unable to create descriptor pool.");
+    return pool;
+}
+
+// Bump-allocates from the current frame's pools, appending a larger pool when they are exhausted.
+// The pools persist across frames, so after a few frames this no longer creates any pools.
+void LavaDescCacheImpl::allocateTransientSet(VkDescriptorSet* set) noexcept {
+    TransientFrame& frame = transientFrames[transientIndex];
+    VkDescriptorSetAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout
+    };
+    for (; frame.active < frame.pools.size(); ++frame.active) {
+        DescriptorPool& pool = frame.pools[frame.active];
+        if (pool.liveCount == pool.capacity) {
+            continue;
+        }
+        allocInfo.descriptorPool = pool.handle;
+        VkResult result = vkAllocateDescriptorSets(device, &allocInfo, set);
+        if (result == VK_SUCCESS) {
+            pool.liveCount++;
+            return;
+        }
+        LOG_CHECK(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL,
+                "Unable to allocate descriptor set.");
     }
-    if (impl->numImageSamplers > 0) {
-        VkDescriptorPoolSize* size = &poolSizes[poolInfo.poolSizeCount++];
-        size->type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        size->descriptorCount = poolInfo.maxSets * impl->numImageSamplers;
+    const uint32_t capacity = frame.pools.empty() ? INITIAL_POOL_CAPACITY :
+            frame.pools.back().capacity * 2;
+    DescriptorPool newPool = createPool(capacity, 0);
+    allocInfo.descriptorPool = newPool.handle;
+    VkResult error = vkAllocateDescriptorSets(device, &allocInfo, set);
+    LOG_CHECK(not error, "Unable to allocate descriptor set.");
+    newPool.liveCount = 1;
+    frame.pools.push_back(newPool);
+}
+
+// Frees the given set and destroys its pool if the pool has drained, unless it is the newest.
+void LavaDescCacheImpl::freeSet(VkDescriptorSet set, VkDescriptorPool pool) noexcept {
+    vkFreeDescriptorSets(device, pool, 1, &set);
+    for (auto iter = pools.begin(); iter != pools.end(); ++iter) {
+        if (iter->handle != pool) {
+            continue;
+        }
+        if (--iter->liveCount == 0 && iter + 1 != pools.end()) {
+            vkDestroyDescriptorPool(device, pool, VKALLOC);
+            pools.erase(iter);
+        }
+        return;
     }
-    if (impl->numInputAttachments > 0) {
-        VkDescriptorPoolSize* size = &poolSizes[poolInfo.poolSizeCount++];
-        size->type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-        size->descriptorCount = poolInfo.maxSets * impl->numInputAttachments;
+}
+
+// Every cache entry owns a set from one of the pools, so the map never holds more entries than the
+// pools have room for. Reserving buckets and nodes for that many entries whenever a pool is added
+// means that neither hits nor misses touch the heap, except for misses that create a pool.
+void LavaDescCacheImpl::reserveEntries() noexcept {
+    size_t capacity = 0;
+    for (const auto& pool : pools) {
+        capacity += pool.capacity;
+    }
+    if (capacity > reservedEntries) {
+        cache.reserve(capacity);
+        nodePool.reserve(capacity - cache.size());
+        reservedEntries = capacity;
     }
-    assert(poolInfo.poolSizeCount > 0);
-    vkCreateDescriptorPool(impl->device, &poolInfo, VKALLOC, &impl->descriptorPool);
+}
 
-    return impl;
+void LavaDescCacheImpl::graveSet(const CacheVal& val) noexcept {
+    graveyard.emplace_back(val.handle, val.pool);
+    graveyard.back().frame = val.frame;
+    graveyard.back().timeMs = val.timeMs;
 }
 
-void LavaDescCache::operator delete(void* ptr) {
-    auto impl = (LavaDescCacheImpl*) ptr;
-    ::delete impl;
+// Marks the given set as the most recently used. The transient set is never cached.
+void LavaDescCacheImpl::touch(CacheVal* val) noexcept {
+    if (val != &transientVal) {
+        lru.touch(val, clock);
+    }
 }
 
-LavaDescCacheImpl::~LavaDescCacheImpl() noexcept {
-    for (auto& pair : cache) {
-        vkFreeDescriptorSets(device, descriptorPool, 1, &pair.second.handle);
+void LavaDescCacheImpl::setBinding(uint32_t index, const BindingRecord& record) noexcept {
+    BindingRecord& current = currentState.bindings[index];
+    if (0 == memcmp(&current, &record, sizeof(record))) {
+        return;
+    }
+    current = record;
+    currentState.hash ^= bindingHashes[index];
+    bindingHashes[index] = murmurHash(record.words, 6, index);
+    currentState.hash ^= bindingHashes[index];
+    dirty = true;
+}
+
+// Clears every matching binding in the current state, then discards all cached descriptor sets
+// that contain a matching binding. Simply waiting for time-based eviction isn't sufficient since
+// handle values may be recycled. We immediately remove the cache entry, but use the graveyard to
+// defer calling vkFreeDescriptorSets.
+void LavaDescCacheImpl::unsetBindings(function<bool(const BindingRecord&, VkDescriptorType)> match)
+        noexcept {
+    const uint32_t count = currentState.count;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (match(currentState.bindings[i], bindingTypes[i])) {
+            setBinding(i, BindingRecord {});
+        }
+    }
+    for (Cache::const_iterator iter = cache.begin(); iter != cache.end();) {
+        const auto& key = iter->first;
+        const auto& val = iter->second;
+        bool removeEntry = false;
+        for (uint32_t i = 0; i < count && !removeEntry; ++i) {
+            removeEntry = match(key.bindings[i], bindingTypes[i]);
+        }
+        if (removeEntry) {
+            if (currentDescriptor == &val) {
+                currentDescriptor = nullptr;
+                dirty = true;
+            }
+            graveSet(val);
+            lru.remove((CacheVal*) &val);
+            iter = cache.erase(iter);
+        } else {
+            ++iter;
+        }
     }
-    vkDestroyDescriptorPool(device, descriptorPool, VKALLOC);
-    vkDestroyDescriptorSetLayout(device, layout, VKALLOC);
 }
 
 VkDescriptorSetLayout LavaDescCache::getLayout() const noexcept {
@@ -238,101 +539,142 @@ VkDescriptorSetLayout LavaDescCache::getLayout() const noexcept {
 bool LavaDescCache::getDescriptorSet(VkDescriptorSet* descriptorSet,
         vector<VkWriteDescriptorSet>* writes) noexcept {
     LavaDescCacheImpl& impl = *upcast(this);
-    if (!impl.dirtyFlags) {
-        impl.currentDescriptor->timestampMs = getCurrentTime();
-        impl.currentDescriptor->timestampFrame = impl.currentFrame;
+    LOG_CHECK(!impl.pushDescriptors, "Push descriptor sets must be bound with bindDescriptorSet.");
+    const bool offsetsDirty = impl.offsetsDirty;
+    impl.offsetsDirty = false;
+    if (!impl.dirty) {
+        impl.touch(impl.currentDescriptor);
         *descriptorSet = impl.currentDescriptor->handle;
-        return false;
+        return offsetsDirty;
+    }
+    impl.dirty = false;
+
+    // Transient sets are never cached, since they only live until the end of the frame. Their
+    // writes would point at the current state, which the next call to a setter overwrites, so
+    // they are always applied here rather than handed to the client.
+    if (!impl.transientFrames.empty()) {
+        impl.allocateTransientSet(descriptorSet);
+        impl.transientVal.handle = *descriptorSet;
+        impl.currentDescriptor = &impl.transientVal;
+        if (writes) {
+            writes->clear();
+        }
+        impl.writeSet(*descriptorSet, impl.currentState, nullptr);
+        return true;
     }
-    impl.dirtyFlags = 0;
+
     auto iter = impl.cache.find(impl.currentState);
     if (iter != impl.cache.end()) {
         impl.currentDescriptor = &(iter->second);
-        impl.currentDescriptor->timestampMs = getCurrentTime();
-        impl.currentDescriptor->timestampFrame = impl.currentFrame;
+        impl.touch(impl.currentDescriptor);
         *descriptorSet = impl.currentDescriptor->handle;
         return true;
     }
 
-    VkDescriptorSetAllocateInfo allocInfo {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = impl.descriptorPool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &impl.layout
-    };
-    vkAllocateDescriptorSets(impl.device, &allocInfo, descriptorSet);
+    VkDescriptorPool pool;
+    impl.allocateSet(descriptorSet, &pool);
 
-    auto& key = impl.currentState;
-    VkWriteDescriptorSet* pWrite = impl.writes.data();
-    VkDescriptorBufferInfo* pBufferWrite = impl.bufferWrites.data();
-    uint32_t binding = 0;
-    for (VkBuffer buffer : key.uniformBuffers) {
-        if (buffer == VK_NULL_HANDLE) {
-            binding++;
+    const size_t size0 = impl.cache.size();
+    iter = impl.cache.emplace(impl.currentState, CacheVal(*descriptorSet, pool)).first;
+    const size_t size1 = impl.cache.size();
+    LOG_CHECK(size1 > size0, "Hash error.");
+    impl.currentDescriptor = &(iter->second);
+    impl.currentDescriptor->key = &iter->first;
+    impl.touch(impl.currentDescriptor);
+    impl.reserveEntries();
+
+    // The writes point directly at the records in the cached key, which are stable until the
+    // descriptor set is evicted.
+    return impl.writeSet(*descriptorSet, iter->first, writes);
+}
+
+// Populates the writes array with every binding that has been set in the given key.
+uint32_t LavaDescCacheImpl::buildWrites(VkDescriptorSet set, const CacheKey& key) noexcept {
+    VkWriteDescriptorSet* pWrite = writes;
+    for (uint32_t binding = 0; binding < key.count; ++binding) {
+        const BindingRecord& record = key.bindings[binding];
+        if (isUnset(record)) {
             continue;
         }
+        const VkDescriptorType type = bindingTypes[binding];
         *pWrite++ = {
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = *descriptorSet,
-            .dstBinding = binding++,
+            .dstSet = set,
+            .dstBinding = binding,
             .descriptorCount = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .pBufferInfo = pBufferWrite
-        };
-        *pBufferWrite++ = {
-            .buffer = buffer,
-            .offset = 0,
-            .range = VK_WHOLE_SIZE
+            .descriptorType = type,
+            .pBufferInfo = isBufferType(type) ? &record.buffer : nullptr,
+            .pImageInfo = isImageType(type) ? &record.image : nullptr,
+            .pTexelBufferView = isTexelType(type) ? &record.texelBuffer : nullptr,
         };
     }
-    VkDescriptorImageInfo* pInfoWrite = impl.imageWrites.data();
-    for (VkDescriptorImageInfo info : key.imageSamplers) {
-        if (info.sampler == VK_NULL_HANDLE) {
-            binding++;
-            continue;
+    return (uint32_t) (pWrite - writes);
+}
+
+// Fills a newly allocated set with every binding that has been set in the given key, or returns
+// the writes to the client if requested. Returns true if there was anything to write. When every
+// binding is set, the update template consumes the key's records directly.
+bool LavaDescCacheImpl::writeSet(VkDescriptorSet set, const CacheKey& key,
+        vector<VkWriteDescriptorSet>* clientWrites) noexcept {
+    if (updateTemplate && !clientWrites) {
+        bool complete = true;
+        for (uint32_t binding = 0; binding < key.count && complete; ++binding) {
+            complete = !isUnset(key.bindings[binding]);
         }
-        *pWrite++ = {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = *descriptorSet,
-            .dstBinding = binding++,
-            .descriptorCount = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .pImageInfo = pInfoWrite
-        };
-        *pInfoWrite++ = info;
-    }
-    for (VkDescriptorImageInfo info : key.inputAttachments) {
-        if (info.sampler == VK_NULL_HANDLE) {
-            binding++;
-            continue;
+        if (complete) {
+            vkUpdateDescriptorSetWithTemplateKHR(device, set, updateTemplate, key.bindings);
+            return true;
         }
-        *pWrite++ = {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = *descriptorSet,
-            .dstBinding = binding++,
-            .descriptorCount = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-            .pImageInfo = pInfoWrite
-        };
-        *pInfoWrite++ = info;
     }
-
-    const size_t nwrites = pWrite - impl.writes.data();
-    if (writes) {
-        *writes = impl.writes;
-        writes->resize(nwrites);
+    const uint32_t nwrites = buildWrites(set, key);
+    if (clientWrites) {
+        clientWrites->assign(writes, writes + nwrites);
     } else {
-        vkUpdateDescriptorSets(impl.device, nwrites, impl.writes.data(), 0, nullptr);
+        vkUpdateDescriptorSets(device, nwrites, writes, 0, nullptr);
     }
+    return nwrites > 0;
+}
 
-    const size_t size0 = impl.cache.size();
-    iter = impl.cache.emplace(make_pair(impl.currentState, CacheVal {
-        *descriptorSet, getCurrentTime(), impl.currentFrame })).first;
-    const size_t size1 = impl.cache.size();
-    LOG_CHECK(size1 > size0, "Hash error.");
+void LavaDescCache::bindDescriptorSet(VkCommandBuffer cmdbuffer, VkPipelineBindPoint bindPoint,
+        VkPipelineLayout pipelineLayout, uint32_t setIndex) noexcept {
+    LavaDescCacheImpl& impl = *upcast(this);
 
-    impl.currentDescriptor = &(iter->second);
-    return nwrites > 0;
+    // The cache cannot know whether the command buffer has been reset, or whether another cache
+    // has since bound the same set index, so it always binds. Push descriptors bypass pools and
+    // the cache entirely; the driver copies the writes into the command buffer.
+    if (impl.pushDescriptors) {
+        impl.dirty = false;
+        const uint32_t nwrites = impl.buildWrites(VK_NULL_HANDLE, impl.currentState);
+        vkCmdPushDescriptorSetKHR(cmdbuffer, bindPoint, pipelineLayout, setIndex, nwrites,
+                impl.writes);
+        return;
+    }
+
+    VkDescriptorSet set;
+    getDescriptorSet(&set, nullptr);
+    vkCmdBindDescriptorSets(cmdbuffer, bindPoint, pipelineLayout, setIndex, 1, &set,
+            impl.numDynamicBuffers, impl.dynamicOffsets);
+}
+
+bool LavaDescCache::usesPushDescriptors() const noexcept {
+    return upcast(this)->pushDescriptors;
+}
+
+void LavaDescCache::nextFrame() noexcept {
+    LavaDescCacheImpl& impl = *upcast(this);
+    if (impl.transientFrames.empty()) {
+        return;
+    }
+    impl.transientIndex = (impl.transientIndex + 1) % impl.transientFrames.size();
+    TransientFrame& frame = impl.transientFrames[impl.transientIndex];
+    for (auto& pool : frame.pools) {
+        if (pool.liveCount > 0) {
+            vkResetDescriptorPool(impl.device, pool.handle, 0);
+            pool.liveCount = 0;
+        }
+    }
+    frame.active = 0;
+    impl.dirty = true;
 }
 
 VkDescriptorSet LavaDescCache::getDescriptor() noexcept {
@@ -351,55 +693,96 @@ VkDescriptorSet* LavaDescCache::getDescPointer() noexcept {
 void LavaDescCache::setUniformBuffer(uint32_t bindingIndex, VkBuffer uniformBuffer) noexcept {
     LavaDescCacheImpl* impl = upcast(this);
     LOG_CHECK(bindingIndex < impl->numUniformBuffers, "Uniform binding out of range.");
-    auto& buffers = impl->currentState.uniformBuffers;
-    assert(bindingIndex < buffers.size());
-    if (buffers[bindingIndex] != uniformBuffer) {
-        impl->dirtyFlags |= DirtyFlag::UNIFORM_BUFFER;
-        buffers[bindingIndex] = uniformBuffer;
+    impl->setBinding(bindingIndex, makeRecord(uniformBuffer));
+}
+
+void LavaDescCache::setDynamicUniformBuffer(uint32_t bindingIndex, VkDescriptorBufferInfo binding)
+        noexcept {
+    LavaDescCacheImpl* impl = upcast(this);
+    LOG_CHECK(bindingIndex >= impl->numUniformBuffers &&
+            bindingIndex < impl->numUniformBuffers + impl->numDynamicBuffers,
+            "Dynamic uniform binding out of range.");
+    LOG_CHECK(binding.range != VK_WHOLE_SIZE, "Dynamic uniform buffers require a range.");
+    impl->setBinding(bindingIndex, makeRecord(binding));
+}
+
+void LavaDescCache::setDynamicOffset(uint32_t bindingIndex, uint32_t offset) noexcept {
+    LavaDescCacheImpl* impl = upcast(this);
+    LOG_CHECK(bindingIndex >= impl->numUniformBuffers &&
+            bindingIndex < impl->numUniformBuffers + impl->numDynamicBuffers,
+            "Dynamic uniform binding out of range.");
+    uint32_t& current = impl->dynamicOffsets[bindingIndex - impl->numUniformBuffers];
+    if (current != offset) {
+        current = offset;
+        impl->offsetsDirty = true;
     }
 }
 
+const uint32_t* LavaDescCache::getDynamicOffsets() const noexcept {
+    return upcast(this)->dynamicOffsets;
+}
+
+uint32_t LavaDescCache::getDynamicOffsetCount() const noexcept {
+    return upcast(this)->numDynamicBuffers;
+}
+
 void LavaDescCache::setImageSampler(uint32_t bindingIndex, VkDescriptorImageInfo binding) noexcept {
     LavaDescCacheImpl* impl = upcast(this);
-    LOG_CHECK(bindingIndex >= impl->numUniformBuffers &&
-            bindingIndex < impl->numUniformBuffers + impl->numImageSamplers,
+    const uint32_t first = impl->numUniformBuffers + impl->numDynamicBuffers;
+    LOG_CHECK(bindingIndex >= first && bindingIndex < first + impl->numImageSamplers,
             "Sampler binding out of range.");
-    bindingIndex -= impl->numUniformBuffers;
-    auto& imageSamplers = impl->currentState.imageSamplers;
-    assert(bindingIndex < imageSamplers.size());
-    if (!IsEqual()(imageSamplers[bindingIndex], binding)) {
-        impl->dirtyFlags |= DirtyFlag::IMAGE_SAMPLER;
-        imageSamplers[bindingIndex] = binding;
-    }
+    impl->setBinding(bindingIndex, makeRecord(binding));
 }
 
 void LavaDescCache::setInputAttachment(uint32_t bindingIndex, VkDescriptorImageInfo binding) noexcept {
     LavaDescCacheImpl* impl = upcast(this);
-    LOG_CHECK(bindingIndex >= impl->numUniformBuffers + impl->numImageSamplers &&
-            bindingIndex < impl->writes.size(), "Attachment binding out of range.");
-    bindingIndex -= (impl->numUniformBuffers + impl->numImageSamplers);
-    auto& inputAttachments = impl->currentState.inputAttachments;
-    assert(bindingIndex < inputAttachments.size());
-    if (!IsEqual()(inputAttachments[bindingIndex], binding)) {
-        impl->dirtyFlags |= DirtyFlag::INPUT_ATTACHMENT;
-        inputAttachments[bindingIndex] = binding;
-    }
+    LOG_CHECK(impl->hasBindingType(bindingIndex, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT),
+            "Attachment binding out of range.");
+    impl->setBinding(bindingIndex, makeRecord(binding));
+}
+
+void LavaDescCache::setStorageBuffer(uint32_t bindingIndex, VkDescriptorBufferInfo binding)
+        noexcept {
+    LavaDescCacheImpl* impl = upcast(this);
+    LOG_CHECK(impl->hasBindingType(bindingIndex, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+            "Storage buffer binding out of range.");
+    impl->setBinding(bindingIndex, makeRecord(binding));
+}
+
+void LavaDescCache::setStorageImage(uint32_t bindingIndex, VkDescriptorImageInfo binding) noexcept {
+    LavaDescCacheImpl* impl = upcast(this);
+    LOG_CHECK(impl->hasBindingType(bindingIndex, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE),
+            "Storage image binding out of range.");
+    impl->setBinding(bindingIndex, makeRecord(binding));
+}
+
+void LavaDescCache::setTexelBuffer(uint32_t bindingIndex, VkBufferView bufferView) noexcept {
+    LavaDescCacheImpl* impl = upcast(this);
+    LOG_CHECK(impl->hasBindingType(bindingIndex, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER) ||
+            impl->hasBindingType(bindingIndex, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER),
+            "Texel buffer binding out of range.");
+    impl->setBinding(bindingIndex, makeRecord(bufferView));
 }
 
 void LavaDescCache::evictDescriptors(uint64_t milliseconds, uint64_t nframes) noexcept {
     LavaDescCacheImpl& impl = *upcast(this);
-    const uint64_t expirationMs = getCurrentTime() - milliseconds;
-    const uint64_t currentFrame = impl.currentFrame++;
+    const uint64_t expirationMs = impl.clock.now() - milliseconds;
+    const uint64_t currentFrame = impl.clock.ticking ? impl.clock.frame : impl.clock.frame++;
     const uint64_t expirationFrame = (nframes > currentFrame) ? 0 : currentFrame - nframes;
-    auto& cache = impl.cache;
-    for (decltype(impl.cache)::const_iterator iter = cache.begin(); iter != cache.end();) {
-        const auto& val = iter->second;
-        if (val.timestampMs < expirationMs && val.timestampFrame < expirationFrame) {
-            vkFreeDescriptorSets(impl.device, impl.descriptorPool, 1, &val.handle);
-            iter = cache.erase(iter);
-        } else {
-            ++iter;
+
+    // Pop from the tail of the LRU list until reaching a set that is still in use.
+    while (LavaLruNode* node = impl.lru.oldest()) {
+        CacheVal* val = static_cast<CacheVal*>(node);
+        if (val->timeMs >= expirationMs || val->frame >= expirationFrame) {
+            break;
+        }
+        if (impl.currentDescriptor == val) {
+            impl.currentDescriptor = nullptr;
+            impl.dirty = true;
         }
+        impl.lru.remove(val);
+        impl.freeSet(val->handle, val->pool);
+        impl.cache.erase(impl.cache.find(*val->key));
     }
 
     // The graveyard is composed of descriptors that contain references to now-extinct buffers. We
@@ -409,73 +792,74 @@ void LavaDescCache::evictDescriptors(uint64_t milliseconds, uint64_t nframes) no
     decltype(impl.graveyard) graveyard;
     graveyard.swap(impl.graveyard);
     for (auto& val : graveyard) {
-        if (val.timestampMs < expirationMs && val.timestampFrame < expirationFrame) {
-           vkFreeDescriptorSets(impl.device, impl.descriptorPool, 1, &val.handle);
+        if (val.timeMs < expirationMs && val.frame < expirationFrame) {
+            impl.freeSet(val.handle, val.pool);
         } else {
-            impl.graveyard.emplace_back(CacheVal {
-                .handle = val.handle,
-                .timestampMs = val.timestampMs,
-                .timestampFrame = val.timestampFrame,
-            });
+            impl.graveSet(val);
         }
     }
 }
 
+void LavaDescCache::tick() noexcept {
+    upcast(this)->clock.tick();
+}
+
 void LavaDescCache::unsetUniformBuffer(VkBuffer uniformBuffer) noexcept {
-    LavaDescCacheImpl& impl = *upcast(this);
-    // First, ensure that this uniform buffer won't be bound on the next call to getDescriptor.
-    for (auto& el : impl.currentState.uniformBuffers) {
-        if (el == uniformBuffer) {
-            impl.dirtyFlags |= DirtyFlag::UNIFORM_BUFFER;
-            el = VK_NULL_HANDLE;
-        }
-    }
-    // Next, discard all descriptor sets that refer to this handle. Simply waiting for time-based
-    // eviction isn't sufficient since the handle value may be recycled. We immediately remove the
-    // cache entry, but use the graveyard to defer calling vkFreeDescriptorSets.
-    auto& cache = impl.cache;
-    for (decltype(impl.cache)::const_iterator iter = cache.begin(); iter != cache.end();) {
-        const auto& key = iter->first;
-        const auto& val = iter->second;
-        bool removeEntry = false;
-        for (VkBuffer ub : key.uniformBuffers) {
-            if (ub == uniformBuffer) {
-                impl.graveyard.emplace_back(CacheVal {
-                    .handle = val.handle,
-                    .timestampMs = val.timestampMs,
-                    .timestampFrame = val.timestampFrame,
-                });
-                removeEntry = true;
-                break;
-            }
-        }
-        if (removeEntry) {
-            iter = cache.erase(iter);
-        } else {
-            ++iter;
-        }
-    }
+    upcast(this)->unsetBindings([uniformBuffer] (const BindingRecord& record,
+            VkDescriptorType type) {
+        return isUniformType(type) && record.buffer.buffer == uniformBuffer;
+    });
+}
+
+void LavaDescCache::unsetStorageBuffer(VkBuffer storageBuffer) noexcept {
+    upcast(this)->unsetBindings([storageBuffer] (const BindingRecord& record,
+            VkDescriptorType type) {
+        return type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER && record.buffer.buffer == storageBuffer;
+    });
+}
+
+void LavaDescCache::unsetStorageImage(VkImageView imageView) noexcept {
+    upcast(this)->unsetBindings([imageView] (const BindingRecord& record, VkDescriptorType type) {
+        return type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE && record.image.imageView == imageView;
+    });
+}
+
+void LavaDescCache::unsetTexelBuffer(VkBufferView bufferView) noexcept {
+    upcast(this)->unsetBindings([bufferView] (const BindingRecord& record, VkDescriptorType type) {
+        return isTexelType(type) && record.texelBuffer == bufferView;
+    });
 }
 
 void LavaDescCache::unsetImageSampler(VkDescriptorImageInfo binding) noexcept {
     // TODO: assume that *all* of the Vulkan handles in "binding" are now extinct and use graveyard.
     LavaDescCacheImpl* impl = upcast(this);
-    for (auto& el : impl->currentState.imageSamplers) {
-        if (IsEqual()(el, binding)) {
-            impl->dirtyFlags |= DirtyFlag::IMAGE_SAMPLER;
-            el = {};
+    const BindingRecord unset = makeRecord(binding);
+    for (uint32_t i = 0; i < impl->currentState.count; ++i) {
+        const BindingRecord& record = impl->currentState.bindings[i];
+        if (impl->bindingTypes[i] == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER &&
+                0 == memcmp(&record, &unset, sizeof(unset))) {
+            impl->setBinding(i, BindingRecord {});
         }
     }
 }
 
 void LavaDescCache::unsetInputAttachment(VkDescriptorImageInfo binding) noexcept {
     LavaDescCacheImpl* impl = upcast(this);
-    for (auto& el : impl->currentState.inputAttachments) {
-        if (IsEqual()(el, binding)) {
-            impl->dirtyFlags |= DirtyFlag::INPUT_ATTACHMENT;
-            el = {};
+    const BindingRecord unset = makeRecord(binding);
+    for (uint32_t i = 0; i < impl->currentState.count; ++i) {
+        const BindingRecord& record = impl->currentState.bindings[i];
+        if (impl->bindingTypes[i] == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT &&
+                0 == memcmp(&record, &unset, sizeof(unset))) {
+            impl->setBinding(i, BindingRecord {});
         }
     }
 }
 
-} // par namespace
\ No newline at end of file
+void LavaDescCache::unsetImageView(VkImageView imageView) noexcept {
+    // As with unsetUniformBuffer, stale descriptor sets are freed later via the graveyard.
+    upcast(this)->unsetBindings([imageView] (const BindingRecord& record, VkDescriptorType type) {
+        return isImageType(type) && record.image.imageView == imageView;
+    });
+}
+
+} // par namespace
@@ -10,12 +10,18 @@
 using namespace par;
 
 struct LavaGpuBufferImpl : LavaGpuBuffer {
-    LavaGpuBufferImpl(Config config) noexcept;
+    LavaGpuBufferImpl(Config config, int importFd = -1) noexcept;
     ~LavaGpuBufferImpl() noexcept;
+    bool relocate(LavaRelocation* reloc) noexcept;
     VkDevice device;
     VkBuffer buffer;
-    VmaAllocation memory;
+    VmaAllocation memory = VK_NULL_HANDLE;
+    VkDeviceMemory external = VK_NULL_HANDLE;
+    VkDeviceSize allocationSize;
     VmaAllocator vma;
+    VkBufferCreateInfo bufferInfo;
+    VmaAllocationCreateInfo allocInfo;
+    LavaMovable movable;
 };
 
 LAVA_DEFINE_UPCAST(LavaGpuBuffer)
@@ -24,25 +30,91 @@ LavaGpuBuffer* LavaGpuBuffer::create(Config config) noexcept {
     return new LavaGpuBufferImpl(config);
 }
 
+LavaGpuBuffer* LavaGpuBuffer::createFromFd(Config config, int fd) noexcept {
+    assert(fd >= 0);
+    return new LavaGpuBufferImpl(config, fd);
+}
+
 void LavaGpuBuffer::operator delete(void* ptr) {
     auto impl = (LavaGpuBufferImpl*) ptr;
     ::delete impl;
 }
 
 LavaGpuBufferImpl::~LavaGpuBufferImpl() noexcept {
+    trackMemory(device, LAVA_MEMORY_GPU_BUFFER, -(int64_t) allocationSize);
+    if (external) {
+        vkDestroyBuffer(device, buffer, VKALLOC);
+        vkFreeMemory(device, external, VKALLOC);
+        return;
+    }
+    unregisterMovable(device, &movable);
     vmaDestroyBuffer(vma, buffer, memory);
 }
 
-LavaGpuBufferImpl::LavaGpuBufferImpl(Config config) noexcept : device(config.device) {
+LavaGpuBufferImpl::LavaGpuBufferImpl(Config config, int importFd) noexcept :
+        device(config.device) {
     assert(config.device && config.gpu && config.size > 0);
     vma = getVma(config.device, config.gpu);
-    VkBufferCreateInfo bufferInfo {
+    bufferInfo = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
         .size = config.size,
-        .usage = config.usage
+        .usage = config.usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+    };
+    if (!config.exportable && importFd < 0) {
+        LavaMemoryPool pool = config.pool;
+        if (pool == LavaMemoryPool::AUTO) {
+            if (config.usage & (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT)) {
+                pool = LavaMemoryPool::GEOMETRY;
+            } else if (config.usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
+                pool = LavaMemoryPool::UNIFORM;
+            } else {
+                pool = LavaMemoryPool::DEFAULT;
+            }
+        }
+        allocInfo = { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
+        createPooledBuffer(device, vma, pool, bufferInfo, &allocInfo, &buffer, &memory);
+        allocationSize = getAllocationSize(vma, memory);
+        trackMemory(device, LAVA_MEMORY_GPU_BUFFER, allocationSize);
+        movable = {
+            .allocation = &memory,
+            .pool = allocInfo.pool,
+            .relocate = [this] (LavaRelocation* reloc) { return relocate(reloc); }
+        };
+        registerMovable(device, &movable);
+        return;
+    }
+
+    // Shareable memory cannot be sub-allocated by VMA, so it gets its own VkDeviceMemory.
+    const VkExternalMemoryBufferCreateInfoKHR externalInfo {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO_KHR,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR,
     };
-    VmaAllocationCreateInfo allocInfo { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
-    vmaCreateBuffer(vma, &bufferInfo, &allocInfo, &buffer, &memory, nullptr);
+    bufferInfo.pNext = &externalInfo;
+    vkCreateBuffer(device, &bufferInfo, VKALLOC, &buffer);
+    bufferInfo.pNext = nullptr;
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(device, buffer, &reqs);
+    external = allocateExternalMemory(device, config.gpu, reqs, importFd, VK_NULL_HANDLE);
+    vkBindBufferMemory(device, buffer, external, 0);
+    allocationSize = reqs.size;
+    trackMemory(device, LAVA_MEMORY_GPU_BUFFER, allocationSize);
+}
+
+bool LavaGpuBufferImpl::relocate(LavaRelocation* reloc) noexcept {
+    VkBuffer newBuffer;
+    VmaAllocation newMemory;
+    if (!createRelocatedBuffer(vma, bufferInfo, allocInfo, reloc, &newBuffer, &newMemory)) {
+        return false;
+    }
+    const VkBufferCopy region { .size = bufferInfo.size };
+    vkCmdCopyBuffer(reloc->cmd, buffer, newBuffer, 1, &region);
+    reloc->buffers.emplace_back(buffer, memory);
+    reloc->oldBuffer = buffer;
+    reloc->newBuffer = newBuffer;
+    buffer = newBuffer;
+    memory = newMemory;
+    return true;
 }
 
 VkBuffer LavaGpuBuffer::getBuffer() const noexcept {
@@ -52,3 +124,8 @@ VkBuffer LavaGpuBuffer::getBuffer() const noexcept {
 const VkBuffer* LavaGpuBuffer::getBufferPtr() const noexcept {
     return &(upcast(this)->buffer);
 }
+
+int LavaGpuBuffer::getFd() const noexcept {
+    auto impl = upcast(this);
+    return getExternalMemoryFd(impl->device, impl->external);
+}
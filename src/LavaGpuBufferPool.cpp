@@ -0,0 +1,193 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#include <par/LavaLoader.h>
+#include <par/LavaGpuBufferPool.h>
+#include <par/LavaLog.h>
+
+#include <map>
+#include <vector>
+
+#include "LavaInternal.h"
+
+using namespace par;
+using namespace std;
+
+namespace {
+
+constexpr uint32_t DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// Each block is a single VkBuffer with a best-fit free list. Free regions are indexed both by size
+// (for fast lookup during allocation) and by offset (for coalescing neighbors during free).
+struct Block {
+    VkBuffer buffer;
+    VmaAllocation memory;
+    VkDeviceSize used;
+    multimap<VkDeviceSize, VkDeviceSize> freeBySize;
+    map<VkDeviceSize, VkDeviceSize> freeByOffset;
+};
+
+struct LavaGpuBufferPoolImpl : LavaGpuBufferPool {
+    ~LavaGpuBufferPoolImpl() noexcept;
+    void addBlock() noexcept;
+    bool allocate(Block& block, VkDeviceSize size, VkDeviceSize alignment, Range* result) noexcept;
+    void addFreeRegion(Block& block, VkDeviceSize offset, VkDeviceSize size) noexcept;
+    void removeFreeRegion(Block& block, VkDeviceSize offset, VkDeviceSize size) noexcept;
+    VkDevice device;
+    VmaAllocator vma;
+    VkDeviceSize blockSize;
+    VkBufferUsageFlags usage;
+    vector<Block> blocks;
+};
+
+LAVA_DEFINE_UPCAST(LavaGpuBufferPool)
+
+} // anonymous namespace
+
+LavaGpuBufferPool* LavaGpuBufferPool::create(Config config) noexcept {
+    assert(config.device && config.gpu);
+    auto impl = new LavaGpuBufferPoolImpl;
+    impl->device = config.device;
+    impl->vma = getVma(config.device, config.gpu);
+    impl->blockSize = config.blockSize ? config.blockSize : DEFAULT_BLOCK_SIZE;
+    impl->usage = config.usage;
+    impl->addBlock();
+    return impl;
+}
+
+void LavaGpuBufferPool::operator delete(void* ptr) {
+    auto impl = (LavaGpuBufferPoolImpl*) ptr;
+    ::delete impl;
+}
+
+LavaGpuBufferPoolImpl::~LavaGpuBufferPoolImpl() noexcept {
+    for (auto& block : blocks) {
+        trackMemory(device, LAVA_MEMORY_GPU_BUFFER, -(int64_t) blockSize);
+        vmaDestroyBuffer(vma, block.buffer, block.memory);
+    }
+}
+
+void LavaGpuBufferPoolImpl::addBlock() noexcept {
+    VkBufferCreateInfo bufferInfo {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = blockSize,
+        .usage = usage
+    };
+    VmaAllocationCreateInfo allocInfo { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
+    blocks.emplace_back();
+    Block& block = blocks.back();
+    block.used = 0;
+    VkResult err = vmaCreateBuffer(vma, &bufferInfo, &allocInfo, &block.buffer, &block.memory,
+            nullptr);
+    LOG_CHECK(!err, "Unable to allocate buffer pool block.");
+    trackMemory(device, LAVA_MEMORY_GPU_BUFFER, blockSize);
+    addFreeRegion(block, 0, blockSize);
+}
+
+void LavaGpuBufferPoolImpl::addFreeRegion(Block& block, VkDeviceSize offset, VkDeviceSize size)
+        noexcept {
+    block.freeByOffset.emplace(offset, size);
+    block.freeBySize.emplace(size, offset);
+}
+
+void LavaGpuBufferPoolImpl::removeFreeRegion(Block& block, VkDeviceSize offset, VkDeviceSize size)
+        noexcept {
+    block.freeByOffset.erase(offset);
+    auto range = block.freeBySize.equal_range(size);
+    for (auto iter = range.first; iter != range.second; ++iter) {
+        if (iter->second == offset) {
+            block.freeBySize.erase(iter);
+            return;
+        }
+    }
+    assert(false && "Free list is inconsistent.");
+}
+
+bool LavaGpuBufferPoolImpl::allocate(Block& block, VkDeviceSize size, VkDeviceSize alignment,
+        Range* result) noexcept {
+    // Walk the free regions from smallest to largest, starting with the first that could possibly
+    // fit. Alignment padding can make a candidate too small, in which case we try the next one.
+    for (auto iter = block.freeBySize.lower_bound(size); iter != block.freeBySize.end(); ++iter) {
+        const VkDeviceSize regionSize = iter->first;
+        const VkDeviceSize regionOffset = iter->second;
+        const VkDeviceSize offset = (regionOffset + alignment - 1) / alignment * alignment;
+        const VkDeviceSize padding = offset - regionOffset;
+        if (padding + size > regionSize) {
+            continue;
+        }
+        removeFreeRegion(block, regionOffset, regionSize);
+        if (padding > 0) {
+            addFreeRegion(block, regionOffset, padding);
+        }
+        const VkDeviceSize tail = regionSize - padding - size;
+        if (tail > 0) {
+            addFreeRegion(block, offset + size, tail);
+        }
+        block.used += size;
+        *result = { block.buffer, offset, size };
+        return true;
+    }
+    return false;
+}
+
+LavaGpuBufferPool::Range LavaGpuBufferPool::allocate(uint32_t size, uint32_t alignment) noexcept {
+    LavaGpuBufferPoolImpl* impl = upcast(this);
+    assert(size > 0 && alignment > 0);
+    Range result {};
+    if (size > impl->blockSize) {
+        llog.error("Buffer pool request of {} bytes exceeds the block size.", size);
+        return result;
+    }
+    for (auto& block : impl->blocks) {
+        if (impl->allocate(block, size, alignment, &result)) {
+            return result;
+        }
+    }
+    impl->addBlock();
+    impl->allocate(impl->blocks.back(), size, alignment, &result);
+    return result;
+}
+
+void LavaGpuBufferPool::free(const Range& range) noexcept {
+    LavaGpuBufferPoolImpl* impl = upcast(this);
+    auto& blocks = impl->blocks;
+    size_t index = 0;
+    while (index < blocks.size() && blocks[index].buffer != range.buffer) {
+        ++index;
+    }
+    LOG_CHECK(index < blocks.size(), "Range does not belong to this pool.");
+    Block& block = blocks[index];
+    block.used -= range.size;
+
+    // Coalesce with the free regions that immediately precede and follow this range.
+    VkDeviceSize offset = range.offset;
+    VkDeviceSize size = range.size;
+    auto next = block.freeByOffset.lower_bound(offset);
+    if (next != block.freeByOffset.end() && next->first == offset + size) {
+        const VkDeviceSize nextSize = next->second;
+        impl->removeFreeRegion(block, offset + size, nextSize);
+        size += nextSize;
+    }
+    next = block.freeByOffset.lower_bound(offset);
+    if (next != block.freeByOffset.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            const VkDeviceSize prevOffset = prev->first;
+            const VkDeviceSize prevSize = prev->second;
+            impl->removeFreeRegion(block, prevOffset, prevSize);
+            offset = prevOffset;
+            size += prevSize;
+        }
+    }
+    impl->addFreeRegion(block, offset, size);
+
+    if (block.used == 0 && index > 0) {
+        trackMemory(impl->device, LAVA_MEMORY_GPU_BUFFER, -(int64_t) impl->blockSize);
+        vmaDestroyBuffer(impl->vma, block.buffer, block.memory);
+        blocks.erase(blocks.begin() + index);
+    }
+}
+
+uint32_t LavaGpuBufferPool::getBlockCount() const noexcept {
+    return (uint32_t) upcast(this)->blocks.size();
+}
@@ -7,22 +7,79 @@
 #define VMA_IMPLEMENTATION
 #include "LavaInternal.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <unordered_map>
+#include <mutex>
+#include <thread>
 
 namespace par {
 
-static std::unordered_map<VkDevice, VmaAllocator> sVmaAllocators;
+static constexpr size_t kPoolCount = (size_t) LavaMemoryPool::TEXTURE + 1;
+
+// Block sizes for each pool, indexed by LavaMemoryPool. Zero means that VMA's default pools are
+// used instead of a custom pool.
+static constexpr VkDeviceSize kPoolBlockSizes[kPoolCount] {
+    0,                  // AUTO
+    0,                  // DEFAULT
+    16 * 1024 * 1024,   // STAGING
+    4 * 1024 * 1024,    // UNIFORM
+    32 * 1024 * 1024,   // GEOMETRY
+    64 * 1024 * 1024,   // ATTACHMENT
+    64 * 1024 * 1024,   // TEXTURE
+};
+
+// Per-device state lives in a small fixed array so that lookups never need a lock, which allows
+// loader threads to create resources while the render thread is running. Slots are claimed and
+// released under sDeviceMutex, and a slot is published by storing its device handle last.
+struct DeviceState {
+    std::atomic<VkDevice> device;
+    VmaAllocator vma;
+    std::mutex movablesMutex;
+    std::vector<LavaMovable*> movables;
+    std::atomic<int64_t> bytes[LAVA_MEMORY_CATEGORY_COUNT];
+    std::atomic<uint32_t> extensions;
+    std::atomic<LavaStagingRing*> stagingRing;
+    std::atomic<std::thread::id> stagingThread;
+    std::mutex poolMutex;
+    VmaPool pools[kPoolCount][VK_MAX_MEMORY_TYPES];
+};
+
+static constexpr size_t kMaxDevices = 8;
+static DeviceState sDevices[kMaxDevices];
+static std::mutex sDeviceMutex;
+
+static DeviceState* findDevice(VkDevice device) {
+    for (DeviceState& state : sDevices) {
+        if (state.device.load(std::memory_order_acquire) == device) {
+            return &state;
+        }
+    }
+    return nullptr;
+}
+
+static DeviceState& getDeviceState(VkDevice device) {
+    DeviceState* state = findDevice(device);
+    assert(state && "Device has not been registered with createVma.");
+    return *state;
+}
 
 VmaAllocator getVma(VkDevice device, VkPhysicalDevice gpu) {
-    VmaAllocator& vma = sVmaAllocators[device];
-    if (vma == VK_NULL_HANDLE) {
+    DeviceState* state = findDevice(device);
+    if (!state) {
         createVma(device, gpu);
+        state = findDevice(device);
     }
-    return vma;
+    return state->vma;
 }
 
 void createVma(VkDevice device, VkPhysicalDevice gpu) {
+    std::lock_guard<std::mutex> lock(sDeviceMutex);
+    if (findDevice(device)) {
+        return;
+    }
+    DeviceState* state = findDevice(VK_NULL_HANDLE);
+    LOG_CHECK(state, "Too many devices.");
     VmaVulkanFunctions funcs {
         .vkGetPhysicalDeviceProperties = vkGetPhysicalDeviceProperties,
         .vkGetPhysicalDeviceMemoryProperties = vkGetPhysicalDeviceMemoryProperties,
@@ -41,18 +98,504 @@ void createVma(VkDevice device, VkPhysicalDevice gpu) {
         .vkGetBufferMemoryRequirements2KHR = vkGetBufferMemoryRequirements2KHR,
         .vkGetImageMemoryRequirements2KHR = vkGetImageMemoryRequirements2KHR,
     };
+    // Leave out VMA_ALLOCATOR_CREATE_EXTERNALLY_SYNCHRONIZED_BIT since the allocator is shared
+    // across threads.
     VmaAllocatorCreateInfo info = {
+        .flags = 0,
         .physicalDevice = gpu,
         .device = device,
         .pVulkanFunctions = &funcs,
     };
-    auto& vma = sVmaAllocators[device] = VmaAllocator();
-    vmaCreateAllocator(&info, &vma);
+    state->vma = VK_NULL_HANDLE;
+    vmaCreateAllocator(&info, &state->vma);
+    state->movables.clear();
+    state->extensions = 0;
+    state->stagingRing = nullptr;
+    for (auto& bytes : state->bytes) {
+        bytes = 0;
+    }
+    for (auto& pools : state->pools) {
+        for (VmaPool& pool : pools) {
+            pool = VK_NULL_HANDLE;
+        }
+    }
+    state->device.store(device, std::memory_order_release);
+}
+
+void setDeviceExtensions(VkDevice device, uint32_t extensions) {
+    getDeviceState(device).extensions = extensions;
+}
+
+bool hasDeviceExtension(VkDevice device, LavaDeviceExtension extension) {
+    DeviceState* state = findDevice(device);
+    return state && (state->extensions & extension);
+}
+
+void setDefaultStagingRing(VkDevice device, LavaStagingRing* ring) {
+    DeviceState& state = getDeviceState(device);
+    state.stagingThread = std::this_thread::get_id();
+    state.stagingRing = ring;
+}
+
+LavaStagingRing* getDefaultStagingRing(VkDevice device) {
+    DeviceState* state = findDevice(device);
+    LavaStagingRing* ring = state ? state->stagingRing.load() : nullptr;
+    return ring && state->stagingThread.load() == std::this_thread::get_id() ? ring : nullptr;
 }
 
 void destroyVma(VkDevice device) {
-    vmaDestroyAllocator(sVmaAllocators[device]);
-    sVmaAllocators[device] = VK_NULL_HANDLE;
+    std::lock_guard<std::mutex> lock(sDeviceMutex);
+    DeviceState* state = findDevice(device);
+    if (state) {
+        for (auto& pools : state->pools) {
+            for (VmaPool pool : pools) {
+                if (pool) {
+                    vmaDestroyPool(state->vma, pool);
+                }
+            }
+        }
+        vmaDestroyAllocator(state->vma);
+        state->vma = VK_NULL_HANDLE;
+        state->device.store(VK_NULL_HANDLE, std::memory_order_release);
+    }
+}
+
+static VmaPool getPool(VkDevice device, VmaAllocator vma, LavaMemoryPool type,
+        uint32_t memoryTypeIndex) {
+    DeviceState& state = getDeviceState(device);
+    std::lock_guard<std::mutex> lock(state.poolMutex);
+    VmaPool& pool = state.pools[(size_t) type][memoryTypeIndex];
+    if (!pool) {
+        // Clients choose the pool of each resource, so buffers and optimally tiled images can
+        // share a pool and VMA must honor bufferImageGranularity between them.
+        const VmaPoolCreateInfo info {
+            .memoryTypeIndex = memoryTypeIndex,
+            .blockSize = kPoolBlockSizes[(size_t) type],
+        };
+        VkResult err = vmaCreatePool(vma, &info, &pool);
+        LOG_CHECK(!err, "Unable to create memory pool.");
+    }
+    return pool;
+}
+
+VkResult createPooledBuffer(VkDevice device, VmaAllocator vma, LavaMemoryPool pool,
+        const VkBufferCreateInfo& info, VmaAllocationCreateInfo* allocInfo, VkBuffer* buffer,
+        VmaAllocation* memory) {
+    const VkDeviceSize blockSize = kPoolBlockSizes[(size_t) pool];
+    uint32_t memoryTypeIndex;
+    if (blockSize && info.size <= blockSize / 2 &&
+            !vmaFindMemoryTypeIndexForBufferInfo(vma, &info, allocInfo, &memoryTypeIndex)) {
+        allocInfo->pool = getPool(device, vma, pool, memoryTypeIndex);
+        if (!vmaCreateBuffer(vma, &info, allocInfo, buffer, memory, nullptr)) {
+            return VK_SUCCESS;
+        }
+        allocInfo->pool = VK_NULL_HANDLE;
+    }
+    return vmaCreateBuffer(vma, &info, allocInfo, buffer, memory, nullptr);
+}
+
+VkResult createPooledImage(VkDevice device, VmaAllocator vma, LavaMemoryPool pool,
+        const VkImageCreateInfo& info, VmaAllocationCreateInfo* allocInfo, VkImage* image,
+        VmaAllocation* memory) {
+    uint32_t memoryTypeIndex;
+    if (kPoolBlockSizes[(size_t) pool] &&
+            !vmaFindMemoryTypeIndexForImageInfo(vma, &info, allocInfo, &memoryTypeIndex)) {
+        allocInfo->pool = getPool(device, vma, pool, memoryTypeIndex);
+        if (!vmaCreateImage(vma, &info, allocInfo, image, memory, nullptr)) {
+            return VK_SUCCESS;
+        }
+        allocInfo->pool = VK_NULL_HANDLE;
+    }
+    return vmaCreateImage(vma, &info, allocInfo, image, memory, nullptr);
+}
+
+VkDeviceMemory allocateExternalMemory(VkDevice device, VkPhysicalDevice gpu,
+        const VkMemoryRequirements& reqs, int importFd, VkImage dedicatedImage) {
+    LOG_CHECK(vkGetMemoryFdKHR, "VK_KHR_external_memory_fd is not available.");
+    VmaAllocationCreateInfo vmaInfo { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
+    uint32_t memoryTypeIndex;
+    VkResult err = vmaFindMemoryTypeIndex(getVma(device, gpu), reqs.memoryTypeBits, &vmaInfo,
+            &memoryTypeIndex);
+    LOG_CHECK(!err, "Unable to find memory type for external memory.");
+    const VkMemoryDedicatedAllocateInfoKHR dedicatedInfo {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO_KHR,
+        .image = dedicatedImage,
+    };
+    const bool dedicated = dedicatedImage &&
+            hasDeviceExtension(device, LAVA_DEVICE_EXT_DEDICATED_ALLOCATION);
+    const VkExportMemoryAllocateInfoKHR exportInfo {
+        .sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO_KHR,
+        .pNext = dedicated ? &dedicatedInfo : nullptr,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR,
+    };
+    const VkImportMemoryFdInfoKHR importInfo {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+        .pNext = dedicated ? &dedicatedInfo : nullptr,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR,
+        .fd = importFd,
+    };
+    const VkMemoryAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = importFd < 0 ? (const void*) &exportInfo : (const void*) &importInfo,
+        .allocationSize = reqs.size,
+        .memoryTypeIndex = memoryTypeIndex,
+    };
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    err = vkAllocateMemory(device, &allocInfo, VKALLOC, &memory);
+    LOG_CHECK(!err, "Unable to allocate external memory.");
+    return memory;
+}
+
+int getExternalMemoryFd(VkDevice device, VkDeviceMemory memory) {
+    const VkMemoryGetFdInfoKHR info {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR,
+        .memory = memory,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR,
+    };
+    int fd = -1;
+    if (!memory || vkGetMemoryFdKHR(device, &info, &fd) != VK_SUCCESS) {
+        llog.error("Unable to export memory, was it created as exportable?");
+        return -1;
+    }
+    return fd;
+}
+
+void registerMovable(VkDevice device, LavaMovable* movable) {
+    DeviceState& state = getDeviceState(device);
+    std::lock_guard<std::mutex> lock(state.movablesMutex);
+    state.movables.push_back(movable);
+}
+
+void unregisterMovable(VkDevice device, LavaMovable* movable) {
+    DeviceState& state = getDeviceState(device);
+    std::lock_guard<std::mutex> lock(state.movablesMutex);
+    auto& movables = state.movables;
+    for (size_t i = 0; i < movables.size(); ++i) {
+        if (movables[i] == movable) {
+            movables[i] = movables.back();
+            movables.pop_back();
+            return;
+        }
+    }
+}
+
+void forEachMovable(VkDevice device, const std::function<void(LavaMovable*)>& visit) {
+    DeviceState& state = getDeviceState(device);
+    std::lock_guard<std::mutex> lock(state.movablesMutex);
+    for (LavaMovable* movable : state.movables) {
+        visit(movable);
+    }
+}
+
+bool relocateMovable(VkDevice device, LavaMovable* movable, LavaRelocation* reloc,
+        VkDeviceSize* size) {
+    DeviceState& state = getDeviceState(device);
+    std::lock_guard<std::mutex> lock(state.movablesMutex);
+    const auto& movables = state.movables;
+    if (std::find(movables.begin(), movables.end(), movable) == movables.end()) {
+        return false;
+    }
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(state.vma, *movable->allocation, &info);
+    if (info.deviceMemory != reloc->sourceMemory) {
+        return false;
+    }
+    *size = info.size;
+    return movable->relocate(reloc);
+}
+
+// VMA does not let callers exclude a block, so allocations that land in the block being evacuated
+// are held as placeholders and the request is retried. Each placeholder fills a hole in the source
+// block, which eventually forces VMA to choose another block or to give up.
+constexpr int MAX_RELOCATION_ATTEMPTS = 16;
+
+bool createRelocatedBuffer(VmaAllocator vma, const VkBufferCreateInfo& info,
+        const VmaAllocationCreateInfo& originalInfo, LavaRelocation* reloc, VkBuffer* buffer,
+        VmaAllocation* memory) {
+    VmaAllocationCreateInfo allocInfo = originalInfo;
+    allocInfo.flags |= VMA_ALLOCATION_CREATE_NEVER_ALLOCATE_BIT;
+    std::vector<std::pair<VkBuffer, VmaAllocation>> placeholders;
+    bool success = false;
+    for (int attempt = 0; attempt < MAX_RELOCATION_ATTEMPTS; ++attempt) {
+        VmaAllocationInfo result;
+        if (vmaCreateBuffer(vma, &info, &allocInfo, buffer, memory, &result) != VK_SUCCESS) {
+            break;
+        }
+        if (result.deviceMemory != reloc->sourceMemory) {
+            success = true;
+            break;
+        }
+        placeholders.emplace_back(*buffer, *memory);
+    }
+    for (const auto& pair : placeholders) {
+        vmaDestroyBuffer(vma, pair.first, pair.second);
+    }
+    return success;
+}
+
+bool createRelocatedImage(VmaAllocator vma, const VkImageCreateInfo& info,
+        const VmaAllocationCreateInfo& originalInfo, LavaRelocation* reloc, VkImage* image,
+        VmaAllocation* memory) {
+    VmaAllocationCreateInfo allocInfo = originalInfo;
+    allocInfo.flags |= VMA_ALLOCATION_CREATE_NEVER_ALLOCATE_BIT;
+    std::vector<std::pair<VkImage, VmaAllocation>> placeholders;
+    bool success = false;
+    for (int attempt = 0; attempt < MAX_RELOCATION_ATTEMPTS; ++attempt) {
+        VmaAllocationInfo result;
+        if (vmaCreateImage(vma, &info, &allocInfo, image, memory, &result) != VK_SUCCESS) {
+            break;
+        }
+        if (result.deviceMemory != reloc->sourceMemory) {
+            success = true;
+            break;
+        }
+        placeholders.emplace_back(*image, *memory);
+    }
+    for (const auto& pair : placeholders) {
+        vmaDestroyImage(vma, pair.first, pair.second);
+    }
+    return success;
+}
+
+// Returns the accesses that are typical for an image in the given layout, which is how the move
+// barriers wait for prior use and make the copy visible to subsequent use.
+static VkAccessFlags getLayoutAccess(VkImageLayout layout) {
+    switch (layout) {
+        case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+            return VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+            return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+        case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+            return VK_ACCESS_SHADER_READ_BIT;
+        case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+            return VK_ACCESS_TRANSFER_READ_BIT;
+        case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+            return VK_ACCESS_TRANSFER_WRITE_BIT;
+        default:
+            return VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+}
+
+void recordImageMove(VkCommandBuffer cmd, VkImage src, VkImage dst, VkImageLayout layout,
+        VkExtent3D extent, uint32_t mipLevels, uint32_t arrayLayers) {
+    const VkAccessFlags access = getLayoutAccess(layout);
+    const VkImageSubresourceRange range {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = 0,
+        .levelCount = mipLevels,
+        .baseArrayLayer = 0,
+        .layerCount = arrayLayers,
+    };
+    VkImageMemoryBarrier barriers[2] = {{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = access,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = layout,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = src,
+        .subresourceRange = range,
+    }, {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = dst,
+        .subresourceRange = range,
+    }};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 2, barriers);
+    std::vector<VkImageCopy> regions(mipLevels);
+    for (uint32_t level = 0; level < mipLevels; ++level) {
+        const VkImageSubresourceLayers layers {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = level,
+            .baseArrayLayer = 0,
+            .layerCount = arrayLayers,
+        };
+        regions[level] = {
+            .srcSubresource = layers,
+            .dstSubresource = layers,
+            .extent = {
+                std::max(extent.width >> level, 1u),
+                std::max(extent.height >> level, 1u),
+                std::max(extent.depth >> level, 1u),
+            },
+        };
+    }
+    vkCmdCopyImage(cmd, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, regions.data());
+    VkImageMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = access,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = dst,
+        .subresourceRange = range,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void trackMemory(VkDevice device, LavaMemoryCategory category, int64_t bytes) {
+    getDeviceState(device).bytes[category] += bytes;
+}
+
+VkDeviceSize getTrackedMemory(VkDevice device, LavaMemoryCategory category) {
+    return (VkDeviceSize) getDeviceState(device).bytes[category].load();
+}
+
+VkDeviceSize getAllocationSize(VmaAllocator vma, VmaAllocation allocation) {
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(vma, allocation, &info);
+    return info.size;
+}
+
+// The registry is independent of DeviceState since apps may create caches for their own devices
+// without ever touching VMA. Layouts are only created at load time, so a linear search suffices.
+template <typename T> struct InternedLayout {
+    VkDevice device;
+    std::vector<uint32_t> signature;
+    T handle;
+    uint32_t refs;
+    // Interned set layouts that a pipeline layout refers to, which it keeps alive.
+    std::vector<VkDescriptorSetLayout> setLayouts;
+};
+
+static std::mutex sLayoutMutex;
+static std::vector<InternedLayout<VkDescriptorSetLayout>> sSetLayouts;
+static std::vector<InternedLayout<VkPipelineLayout>> sPipelineLayouts;
+
+template <typename T> static void appendWords(std::vector<uint32_t>* signature, const T& value) {
+    static_assert(0 == (sizeof(value) & 3), "Signatures require a multiple of 4 bytes.");
+    const uint32_t* words = (const uint32_t*) &value;
+    signature->insert(signature->end(), words, words + sizeof(value) / 4);
+}
+
+template <typename T> static T* findLayout(std::vector<InternedLayout<T>>& layouts,
+        VkDevice device, const std::vector<uint32_t>& signature) {
+    for (auto& layout : layouts) {
+        if (layout.device == device && layout.signature == signature) {
+            layout.refs++;
+            return &layout.handle;
+        }
+    }
+    return nullptr;
+}
+
+// Returns true if the caller should destroy the handle.
+template <typename T> static bool releaseLayout(std::vector<InternedLayout<T>>& layouts,
+        VkDevice device, T handle) {
+    for (size_t i = 0; i < layouts.size(); ++i) {
+        if (layouts[i].device == device && layouts[i].handle == handle) {
+            if (--layouts[i].refs > 0) {
+                return false;
+            }
+            layouts[i] = std::move(layouts.back());
+            layouts.pop_back();
+            return true;
+        }
+    }
+    assert(false && "Layout was not acquired.");
+    return false;
+}
+
+VkDescriptorSetLayout acquireSetLayout(VkDevice device,
+        const VkDescriptorSetLayoutCreateInfo& info) {
+    assert(!info.pNext && "Extended layouts cannot be interned.");
+    std::vector<uint32_t> signature;
+    signature.reserve(1 + info.bindingCount * 4);
+    signature.push_back(info.flags);
+    for (uint32_t i = 0; i < info.bindingCount; ++i) {
+        const VkDescriptorSetLayoutBinding& binding = info.pBindings[i];
+        assert(!binding.pImmutableSamplers && "Immutable samplers cannot be interned.");
+        signature.push_back(binding.binding);
+        signature.push_back(binding.descriptorType);
+        signature.push_back(binding.descriptorCount);
+        signature.push_back(binding.stageFlags);
+    }
+    std::lock_guard<std::mutex> lock(sLayoutMutex);
+    if (VkDescriptorSetLayout* existing = findLayout(sSetLayouts, device, signature)) {
+        return *existing;
+    }
+    VkDescriptorSetLayout layout;
+    VkResult err = vkCreateDescriptorSetLayout(device, &info, VKALLOC, &layout);
+    LOG_CHECK(!err, "Unable to create descriptor set layout.");
+    sSetLayouts.push_back({device, std::move(signature), layout, 1, {}});
+    return layout;
+}
+
+static void releaseSetLayoutLocked(VkDevice device, VkDescriptorSetLayout layout) {
+    if (releaseLayout(sSetLayouts, device, layout)) {
+        vkDestroyDescriptorSetLayout(device, layout, VKALLOC);
+    }
+}
+
+void releaseSetLayout(VkDevice device, VkDescriptorSetLayout layout) {
+    std::lock_guard<std::mutex> lock(sLayoutMutex);
+    releaseSetLayoutLocked(device, layout);
+}
+
+VkPipelineLayout acquirePipelineLayout(VkDevice device, const VkPipelineLayoutCreateInfo& info) {
+    assert(!info.pNext && "Extended layouts cannot be interned.");
+    std::vector<uint32_t> signature;
+    signature.push_back(info.flags);
+    signature.push_back(info.setLayoutCount);
+    for (uint32_t i = 0; i < info.setLayoutCount; ++i) {
+        appendWords(&signature, info.pSetLayouts[i]);
+    }
+    for (uint32_t i = 0; i < info.pushConstantRangeCount; ++i) {
+        appendWords(&signature, info.pPushConstantRanges[i]);
+    }
+    std::lock_guard<std::mutex> lock(sLayoutMutex);
+    if (VkPipelineLayout* existing = findLayout(sPipelineLayouts, device, signature)) {
+        return *existing;
+    }
+    VkPipelineLayout layout;
+    VkResult err = vkCreatePipelineLayout(device, &info, VKALLOC, &layout);
+    LOG_CHECK(!err, "Unable to create pipeline layout.");
+
+    // The signature refers to set layouts by handle, and a destroyed handle can be recycled for an
+    // unrelated layout. Holding a reference on each interned set layout keeps its handle unique
+    // for as long as this signature exists. Set layouts created by the app must likewise outlive
+    // the pipeline layout.
+    std::vector<VkDescriptorSetLayout> setLayouts;
+    for (uint32_t i = 0; i < info.setLayoutCount; ++i) {
+        for (auto& setLayout : sSetLayouts) {
+            if (setLayout.device == device && setLayout.handle == info.pSetLayouts[i]) {
+                setLayout.refs++;
+                setLayouts.push_back(setLayout.handle);
+                break;
+            }
+        }
+    }
+    sPipelineLayouts.push_back({device, std::move(signature), layout, 1, std::move(setLayouts)});
+    return layout;
+}
+
+void releasePipelineLayout(VkDevice device, VkPipelineLayout layout) {
+    std::lock_guard<std::mutex> lock(sLayoutMutex);
+    std::vector<VkDescriptorSetLayout> setLayouts;
+    for (auto& entry : sPipelineLayouts) {
+        if (entry.device == device && entry.handle == layout && entry.refs == 1) {
+            setLayouts.swap(entry.setLayouts);
+        }
+    }
+    if (releaseLayout(sPipelineLayouts, device, layout)) {
+        vkDestroyPipelineLayout(device, layout, VKALLOC);
+        for (VkDescriptorSetLayout setLayout : setLayouts) {
+            releaseSetLayoutLocked(device, setLayout);
+        }
+    }
 }
 
 uint64_t getCurrentTime() {
@@ -61,6 +604,63 @@ uint64_t getCurrentTime() {
     return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
 }
 
+LavaNodePool::~LavaNodePool() {
+    for (void* chunk : mChunks) {
+        ::operator delete(chunk);
+    }
+}
+
+void* LavaNodePool::allocate(size_t size) {
+    size = std::max(size, sizeof(void*));
+    FreeList* list = nullptr;
+    for (FreeList& candidate : mFreeLists) {
+        if (candidate.size == size || candidate.size == 0) {
+            list = &candidate;
+            list->size = size;
+            break;
+        }
+    }
+    if (!list) {
+        return ::operator new(size);
+    }
+    if (!list->head) {
+        addChunk(list, kBlocksPerChunk);
+    }
+    void* block = list->head;
+    list->head = *(void**) block;
+    list->available--;
+    return block;
+}
+
+void LavaNodePool::addChunk(FreeList* list, size_t nblocks) {
+    uint8_t* chunk = (uint8_t*) ::operator new(list->size * nblocks);
+    mChunks.push_back(chunk);
+    for (size_t i = 0; i < nblocks; ++i) {
+        deallocate(chunk + i * list->size, list->size);
+    }
+}
+
+void LavaNodePool::reserve(size_t count) {
+    for (FreeList& list : mFreeLists) {
+        if (list.size && list.available < count) {
+            addChunk(&list, count - list.available);
+        }
+    }
+}
+
+void LavaNodePool::deallocate(void* block, size_t size) {
+    size = std::max(size, sizeof(void*));
+    for (FreeList& list : mFreeLists) {
+        if (list.size == size) {
+            *(void**) block = list.head;
+            list.head = block;
+            list.available++;
+            return;
+        }
+    }
+    ::operator delete(block);
+}
+
 size_t murmurHash(uint32_t const* words, uint32_t nwords, uint32_t seed) {
     if (nwords == 0) {
         return 0;
@@ -3,6 +3,9 @@
 
 #pragma once
 
+#include <par/LavaMemoryPool.h>
+
+#include <functional>
 #include <vector>
 
 #define VKALLOC nullptr
@@ -31,12 +34,180 @@ inline LAVA_UNUSED CLASS##Impl const* upcast(CLASS const* that) noexcept { \
     return static_cast<CLASS##Impl const *>(that); \
 }
 
+// The bundled Vulkan headers predate VK_EXT_descriptor_indexing, so we declare what we need here.
+#ifndef VK_EXT_descriptor_indexing
+#define VK_EXT_descriptor_indexing 1
+#define VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME "VK_EXT_descriptor_indexing"
+#define VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT \
+        ((VkStructureType) 1000161000)
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT \
+        ((VkStructureType) 1000161001)
+#define VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT 0x00000001
+#define VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT 0x00000002
+#define VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT 0x00000004
+#define VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT \
+        ((VkDescriptorSetLayoutCreateFlagBits) 0x00000002)
+#define VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT \
+        ((VkDescriptorPoolCreateFlagBits) 0x00000002)
+typedef VkFlags VkDescriptorBindingFlagsEXT;
+typedef struct VkDescriptorSetLayoutBindingFlagsCreateInfoEXT {
+    VkStructureType sType;
+    const void* pNext;
+    uint32_t bindingCount;
+    const VkDescriptorBindingFlagsEXT* pBindingFlags;
+} VkDescriptorSetLayoutBindingFlagsCreateInfoEXT;
+typedef struct VkPhysicalDeviceDescriptorIndexingFeaturesEXT {
+    VkStructureType sType;
+    void* pNext;
+    VkBool32 shaderInputAttachmentArrayDynamicIndexing;
+    VkBool32 shaderUniformTexelBufferArrayDynamicIndexing;
+    VkBool32 shaderStorageTexelBufferArrayDynamicIndexing;
+    VkBool32 shaderUniformBufferArrayNonUniformIndexing;
+    VkBool32 shaderSampledImageArrayNonUniformIndexing;
+    VkBool32 shaderStorageBufferArrayNonUniformIndexing;
+    VkBool32 shaderStorageImageArrayNonUniformIndexing;
+    VkBool32 shaderInputAttachmentArrayNonUniformIndexing;
+    VkBool32 shaderUniformTexelBufferArrayNonUniformIndexing;
+    VkBool32 shaderStorageTexelBufferArrayNonUniformIndexing;
+    VkBool32 descriptorBindingUniformBufferUpdateAfterBind;
+    VkBool32 descriptorBindingSampledImageUpdateAfterBind;
+    VkBool32 descriptorBindingStorageImageUpdateAfterBind;
+    VkBool32 descriptorBindingStorageBufferUpdateAfterBind;
+    VkBool32 descriptorBindingUniformTexelBufferUpdateAfterBind;
+    VkBool32 descriptorBindingStorageTexelBufferUpdateAfterBind;
+    VkBool32 descriptorBindingUpdateUnusedWhilePending;
+    VkBool32 descriptorBindingPartiallyBound;
+    VkBool32 descriptorBindingVariableDescriptorCount;
+    VkBool32 runtimeDescriptorArray;
+} VkPhysicalDeviceDescriptorIndexingFeaturesEXT;
+#endif
+
 namespace par {
 
+// The per-device allocator is created by LavaContext, or lazily on first use for apps that create
+// their own device. Lookups are lock-free, so getVma can be called from any thread.
 VmaAllocator getVma(VkDevice device, VkPhysicalDevice gpu);
 void createVma(VkDevice device, VkPhysicalDevice gpu);
 void destroyVma(VkDevice device);
 
+// Optional device extensions that Lava objects take advantage of when they are enabled. Only
+// LavaContext sees the device create info, so it records the extensions that it enabled. Devices
+// created by the app fall back to core functionality.
+enum LavaDeviceExtension : uint32_t {
+    LAVA_DEVICE_EXT_DESCRIPTOR_UPDATE_TEMPLATE = 1 << 0,
+    LAVA_DEVICE_EXT_PUSH_DESCRIPTOR = 1 << 1,
+    LAVA_DEVICE_EXT_DESCRIPTOR_INDEXING = 1 << 2,
+    LAVA_DEVICE_EXT_DEDICATED_ALLOCATION = 1 << 3,
+};
+
+void setDeviceExtensions(VkDevice device, uint32_t extensions);
+bool hasDeviceExtension(VkDevice device, LavaDeviceExtension extension);
+
+// The staging ring that textures use when their config does not provide one. LavaContext owns it
+// and flushes it before each of its queue submissions, while devices created by the app have none.
+// Rings are not thread safe, so only the thread that registered the ring can get it.
+class LavaStagingRing;
+void setDefaultStagingRing(VkDevice device, LavaStagingRing* ring);
+LavaStagingRing* getDefaultStagingRing(VkDevice device);
+
+// Interns descriptor set layouts and pipeline layouts by signature, so that caches with identical
+// bindings share a single handle. Sharing layouts makes pipelines from different caches
+// compatible, which lets descriptor sets stay bound across pipeline switches. Handles are
+// reference counted and destroyed when the last user releases them. Pipeline layouts hold a
+// reference on each interned set layout that they use.
+VkDescriptorSetLayout acquireSetLayout(VkDevice device,
+        const VkDescriptorSetLayoutCreateInfo& info);
+void releaseSetLayout(VkDevice device, VkDescriptorSetLayout layout);
+VkPipelineLayout acquirePipelineLayout(VkDevice device, const VkPipelineLayoutCreateInfo& info);
+void releasePipelineLayout(VkDevice device, VkPipelineLayout layout);
+
+// Allocates a dedicated block of device-local memory that can be shared across processes via a
+// POSIX file descriptor. If importFd is negative, the memory is created as exportable, otherwise
+// the memory is imported from the given descriptor (and Vulkan takes ownership of it). Memory for
+// an image is a dedicated allocation when the device supports it, which drivers may require in
+// order to share the image layout, so the exporter and the importer must pass the same kind of
+// image. Pass VK_NULL_HANDLE for buffers.
+VkDeviceMemory allocateExternalMemory(VkDevice device, VkPhysicalDevice gpu,
+        const VkMemoryRequirements& reqs, int importFd, VkImage dedicatedImage);
+
+// Returns a new POSIX file descriptor that refers to the given exportable memory, or -1.
+int getExternalMemoryFd(VkDevice device, VkDeviceMemory memory);
+
+// Creates a buffer or image in the given pool, which is created on first use for each memory type.
+// Resources that do not fit in the pool's blocks fall back to the default pool. On return,
+// allocInfo describes the pool that was actually used, which is needed for relocation.
+VkResult createPooledBuffer(VkDevice device, VmaAllocator vma, LavaMemoryPool pool,
+        const VkBufferCreateInfo& info, VmaAllocationCreateInfo* allocInfo, VkBuffer* buffer,
+        VmaAllocation* memory);
+VkResult createPooledImage(VkDevice device, VmaAllocator vma, LavaMemoryPool pool,
+        const VkImageCreateInfo& info, VmaAllocationCreateInfo* allocInfo, VkImage* image,
+        VmaAllocation* memory);
+
+// Accumulates the state of a single relocation performed by LavaDefragmenter. Resources that are
+// replaced during a relocation are added to the garbage lists and destroyed a few frames later.
+struct LavaRelocation {
+    VkCommandBuffer cmd;
+    VkDeviceMemory sourceMemory;
+    VkBuffer oldBuffer;
+    VkBuffer newBuffer;
+    VkImageView oldView;
+    VkImageView newView;
+    std::vector<std::pair<VkBuffer, VmaAllocation>> buffers;
+    std::vector<std::pair<VkImage, VmaAllocation>> images;
+    std::vector<VkImageView> views;
+    std::vector<VkFramebuffer> framebuffers;
+};
+
+// Device memory that LavaDefragmenter is allowed to move. Resource classes own one of these for
+// the lifetime of their VmaAllocation. The relocate callback creates a replacement that does not
+// live in sourceMemory, records a GPU copy, swaps the handles, and returns false if it cannot.
+// The pool is null for allocations in the default VMA pools.
+struct LavaMovable {
+    VmaAllocation* allocation;
+    VmaPool pool;
+    std::function<bool(LavaRelocation*)> relocate;
+};
+
+// Movables can be unregistered from any thread, so the registry lock is held while visiting them
+// and while relocating one. Unregistering therefore waits for an ongoing relocation to finish.
+// relocateMovable returns false if the movable has since been unregistered, or if it no longer
+// lives in the source memory. Otherwise it returns the result of the relocate callback, along
+// with the size of the allocation.
+void registerMovable(VkDevice device, LavaMovable* movable);
+void unregisterMovable(VkDevice device, LavaMovable* movable);
+void forEachMovable(VkDevice device, const std::function<void(LavaMovable*)>& visit);
+bool relocateMovable(VkDevice device, LavaMovable* movable, LavaRelocation* reloc,
+        VkDeviceSize* size);
+
+// Creates a VMA allocation for an image or buffer without growing the memory heap, which is how
+// the defragmenter ensures that relocation actually compacts memory. Returns false if there is no
+// room in any existing block, or if the only room is in the block being evacuated.
+bool createRelocatedBuffer(VmaAllocator vma, const VkBufferCreateInfo& info,
+        const VmaAllocationCreateInfo& allocInfo, LavaRelocation* reloc, VkBuffer* buffer,
+        VmaAllocation* memory);
+bool createRelocatedImage(VmaAllocator vma, const VkImageCreateInfo& info,
+        const VmaAllocationCreateInfo& allocInfo, LavaRelocation* reloc, VkImage* image,
+        VmaAllocation* memory);
+
+// Records a copy of every mip level from one image to another. The source is expected to be in
+// the given layout, and the destination is left in the same layout. The layout must be known,
+// since an image in VK_IMAGE_LAYOUT_UNDEFINED has no contents worth copying.
+void recordImageMove(VkCommandBuffer cmd, VkImage src, VkImage dst, VkImageLayout layout,
+        VkExtent3D extent, uint32_t mipLevels, uint32_t arrayLayers);
+
+// Running totals of device memory held by each type of Lava object, reported by getMemoryStats.
+enum LavaMemoryCategory {
+    LAVA_MEMORY_TEXTURE,
+    LAVA_MEMORY_ATTACHMENT,
+    LAVA_MEMORY_CPU_BUFFER,
+    LAVA_MEMORY_GPU_BUFFER,
+    LAVA_MEMORY_CATEGORY_COUNT
+};
+
+void trackMemory(VkDevice device, LavaMemoryCategory category, int64_t bytes);
+VkDeviceSize getTrackedMemory(VkDevice device, LavaMemoryCategory category);
+VkDeviceSize getAllocationSize(VmaAllocator vma, VmaAllocation allocation);
+
 uint64_t getCurrentTime();
 size_t murmurHash(uint32_t const* words, uint32_t nwords, uint32_t seed);
 
@@ -48,6 +219,113 @@ struct MurmurHashFn {
     }
 };
 
+// Timestamps for cache entries. After the first tick, the clock is read once per tick rather than
+// on every cache hit, and entries are also stamped with the frame count. Caches that are never
+// ticked fall back to reading the clock whenever an entry is used.
+struct LavaCacheClock {
+    uint64_t frame = 0;
+    uint64_t timeMs = 0;
+    bool ticking = false;
+    void tick() {
+        ticking = true;
+        ++frame;
+        timeMs = getCurrentTime();
+    }
+    uint64_t now() const {
+        return ticking ? timeMs : getCurrentTime();
+    }
+};
+
+// Cache entries derive from this to be linked into a LavaLruList. Node-based maps keep entries at
+// stable addresses, so the links remain valid for as long as the entry lives in the map.
+struct LavaLruNode {
+    LavaLruNode* prev = nullptr;
+    LavaLruNode* next = nullptr;
+    uint64_t frame = 0;
+    uint64_t timeMs = 0;
+};
+
+// Intrusive list of cache entries ordered from most to least recently used. Timestamps are
+// monotonic along the list, so eviction pops from the tail until it finds an entry that is recent
+// enough, which costs time proportional to the number of evicted entries.
+class LavaLruList {
+public:
+    LavaLruList() noexcept {
+        mHead.prev = mHead.next = &mHead;
+    }
+    void touch(LavaLruNode* node, const LavaCacheClock& clock) noexcept {
+        node->frame = clock.frame;
+        node->timeMs = clock.now();
+        if (mHead.next == node) {
+            return;
+        }
+        if (node->next) {
+            remove(node);
+        }
+        node->prev = &mHead;
+        node->next = mHead.next;
+        mHead.next->prev = node;
+        mHead.next = node;
+    }
+    void remove(LavaLruNode* node) noexcept {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = node->next = nullptr;
+    }
+    LavaLruNode* oldest() const noexcept {
+        return mHead.prev == &mHead ? nullptr : mHead.prev;
+    }
+    LavaLruList(LavaLruList const&) = delete;
+    LavaLruList& operator=(LavaLruList const&) = delete;
+private:
+    LavaLruNode mHead;
+};
+
+// Recycles fixed-size blocks, which are carved out of larger chunks. Node-based containers that
+// use LavaNodeAllocator stop touching the heap once they have reached their peak size.
+class LavaNodePool {
+public:
+    LavaNodePool() = default;
+    ~LavaNodePool();
+    void* allocate(size_t size);
+    void deallocate(void* block, size_t size);
+    // Ensures that every block size allocated so far has at least "count" free blocks.
+    void reserve(size_t count);
+    LavaNodePool(LavaNodePool const&) = delete;
+    LavaNodePool& operator=(LavaNodePool const&) = delete;
+private:
+    static constexpr uint32_t kMaxSizes = 4;
+    static constexpr uint32_t kBlocksPerChunk = 64;
+    struct FreeList {
+        size_t size;
+        void* head;
+        size_t available;
+    };
+    void addChunk(FreeList* list, size_t nblocks);
+    FreeList mFreeLists[kMaxSizes] = {};
+    std::vector<void*> mChunks;
+};
+
+template <typename T> struct LavaNodeAllocator {
+    using value_type = T;
+    LavaNodePool* pool;
+    LavaNodeAllocator(LavaNodePool* pool) noexcept : pool(pool) {}
+    template <typename U> LavaNodeAllocator(const LavaNodeAllocator<U>& that) noexcept :
+            pool(that.pool) {}
+    T* allocate(size_t n) {
+        return (T*) (n == 1 ? pool->allocate(sizeof(T)) : ::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t n) {
+        n == 1 ? pool->deallocate(ptr, sizeof(T)) : ::operator delete(ptr);
+    }
+    template <typename U> bool operator==(const LavaNodeAllocator<U>& that) const noexcept {
+        return pool == that.pool;
+    }
+    template <typename U> bool operator!=(const LavaNodeAllocator<U>& that) const noexcept {
+        return pool != that.pool;
+    }
+};
+
 // Wraps a std::vector and exposes the data pointer and size as public fields.
 //
 // This works nicely with Vulkan queries. For example:
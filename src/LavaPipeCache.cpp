@@ -23,9 +23,10 @@ struct CacheKey {
     LavaPipeCache::VertexState vertex;
 };
 
-struct CacheVal {
+struct CacheVal : LavaLruNode {
+    CacheVal(VkPipeline handle) noexcept : handle(handle) {}
     VkPipeline handle;
-    uint64_t timestamp;
+    const CacheKey* key = nullptr;
     // move-only (disallow copy) to allow keeping a pointer to a value in the map.
     CacheVal(CacheVal const&) = delete;
     CacheVal& operator=(CacheVal const&) = delete;
@@ -111,6 +112,8 @@ struct LavaPipeCacheImpl : LavaPipeCache {
     CacheKey currentState;
     uint8_t dirtyFlags = 0xf;
     VkPipelineLayout pipelineLayout;
+    LavaCacheClock clock;
+    LavaLruList lru;
 };
 
 LAVA_DEFINE_UPCAST(LavaPipeCache)
@@ -170,7 +173,7 @@ LavaPipeCache* LavaPipeCache::create(Config config) noexcept {
         .setLayoutCount = (uint32_t) layouts.size(),
         .pSetLayouts = layouts.empty() ? nullptr : layouts.data()
     };
-    vkCreatePipelineLayout(impl->device, &info, VKALLOC, &impl->pipelineLayout);
+    impl->pipelineLayout = acquirePipelineLayout(impl->device, info);
     return impl;
 }
 
@@ -183,7 +186,7 @@ LavaPipeCacheImpl::~LavaPipeCacheImpl() noexcept {
     for (auto& pair : cache) {
         vkDestroyPipeline(device, pair.second.handle, VKALLOC);
     }
-    vkDestroyPipelineLayout(device, pipelineLayout, VKALLOC);
+    releasePipelineLayout(device, pipelineLayout);
 }
 
 VkPipelineLayout LavaPipeCache::getLayout() const noexcept {
@@ -201,7 +204,7 @@ bool LavaPipeCache::getPipeline(VkPipeline* pipeline) noexcept {
     auto impl = upcast(this);
     if (not impl->dirtyFlags) {
         *pipeline = impl->currentPipeline->handle;
-        impl->currentPipeline->timestamp = getCurrentTime();
+        impl->lru.touch(impl->currentPipeline, impl->clock);
         return false;
     }
     impl->dirtyFlags = 0;
@@ -209,7 +212,7 @@ bool LavaPipeCache::getPipeline(VkPipeline* pipeline) noexcept {
     if (iter != impl->cache.end()) {
         impl->currentPipeline = &(iter->second);
         *pipeline = impl->currentPipeline->handle;
-        impl->currentPipeline->timestamp = getCurrentTime();
+        impl->lru.touch(impl->currentPipeline, impl->clock);
         return true;
     }
     auto& key = impl->currentState;
@@ -283,14 +286,13 @@ bool LavaPipeCache::getPipeline(VkPipeline* pipeline) noexcept {
     *pipeline = pipe;
 
     const size_t size0 = impl->cache.size();
-    iter = impl->cache.emplace(make_pair(impl->currentState, CacheVal {
-        .timestamp = getCurrentTime(),
-        .handle = pipe
-    })).first;
+    iter = impl->cache.emplace(make_pair(impl->currentState, CacheVal(pipe))).first;
     const size_t size1 = impl->cache.size();
     LOG_CHECK(size1 > size0, "Hash error.");
 
     impl->currentPipeline = &(iter->second);
+    impl->currentPipeline->key = &iter->first;
+    impl->lru.touch(impl->currentPipeline, impl->clock);
     return true;
 }
 
@@ -343,15 +345,24 @@ void LavaPipeCache::setRenderPass(VkRenderPass renderPass) noexcept {
 
 void LavaPipeCache::releaseUnused(uint64_t milliseconds) noexcept {
     LavaPipeCacheImpl* impl = upcast(this);
-    const uint64_t expiration = getCurrentTime() - milliseconds;
-    auto& cache = impl->cache;
-    for (decltype(impl->cache)::const_iterator iter = cache.begin(); iter != cache.end();) {
-        if (iter->second.timestamp < expiration) {
-            iter = cache.erase(iter);
-        } else {
-            ++iter;
+    const uint64_t expiration = impl->clock.now() - milliseconds;
+    while (LavaLruNode* node = impl->lru.oldest()) {
+        CacheVal* val = static_cast<CacheVal*>(node);
+        if (val->timeMs >= expiration) {
+            break;
         }
+        if (impl->currentPipeline == val) {
+            impl->currentPipeline = nullptr;
+            impl->dirtyFlags = 0xf;
+        }
+        impl->lru.remove(val);
+        vkDestroyPipeline(impl->device, val->handle, VKALLOC);
+        impl->cache.erase(impl->cache.find(*val->key));
     }
 }
 
+void LavaPipeCache::tick() noexcept {
+    upcast(this)->clock.tick();
+}
+
 } // par namespace
\ No newline at end of file
@@ -0,0 +1,123 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#include <par/LavaLoader.h>
+#include <par/LavaSamplerCache.h>
+#include <par/LavaLog.h>
+
+#include <unordered_map>
+
+#include "LavaInternal.h"
+
+using namespace par;
+using namespace std;
+
+namespace {
+
+// Mirrors VkSamplerCreateInfo without the sType, pNext, and padding, so that keys can be hashed
+// and compared as raw words.
+struct CacheKey {
+    VkSamplerCreateFlags flags;
+    VkFilter magFilter;
+    VkFilter minFilter;
+    VkSamplerMipmapMode mipmapMode;
+    VkSamplerAddressMode addressModeU;
+    VkSamplerAddressMode addressModeV;
+    VkSamplerAddressMode addressModeW;
+    float mipLodBias;
+    VkBool32 anisotropyEnable;
+    float maxAnisotropy;
+    VkBool32 compareEnable;
+    VkCompareOp compareOp;
+    float minLod;
+    float maxLod;
+    VkBorderColor borderColor;
+    VkBool32 unnormalizedCoordinates;
+};
+
+struct CacheVal {
+    VkSampler handle;
+    uint64_t hits;
+};
+
+struct IsEqual {
+    bool operator()(const CacheKey& a, const CacheKey& b) const {
+        return 0 == memcmp((const void*) &a, (const void*) &b, sizeof(b));
+    }
+};
+
+using Cache = unordered_map<CacheKey, CacheVal, MurmurHashFn<CacheKey>, IsEqual>;
+
+struct LavaSamplerCacheImpl : LavaSamplerCache {
+    ~LavaSamplerCacheImpl() noexcept;
+    VkDevice device;
+    Cache cache;
+    uint64_t misses = 0;
+};
+
+LAVA_DEFINE_UPCAST(LavaSamplerCache)
+
+} // anonymous namespace
+
+LavaSamplerCache* LavaSamplerCache::create(Config config) noexcept {
+    assert(config.device);
+    auto impl = new LavaSamplerCacheImpl;
+    impl->device = config.device;
+    return impl;
+}
+
+void LavaSamplerCache::operator delete(void* ptr) {
+    auto impl = (LavaSamplerCacheImpl*) ptr;
+    ::delete impl;
+}
+
+LavaSamplerCacheImpl::~LavaSamplerCacheImpl() noexcept {
+    for (auto& pair : cache) {
+        vkDestroySampler(device, pair.second.handle, VKALLOC);
+    }
+}
+
+VkSampler LavaSamplerCache::getSampler(const VkSamplerCreateInfo& info) noexcept {
+    LavaSamplerCacheImpl* impl = upcast(this);
+    assert(info.pNext == nullptr && "Sampler extensions are not supported.");
+    const CacheKey key {
+        .flags = info.flags,
+        .magFilter = info.magFilter,
+        .minFilter = info.minFilter,
+        .mipmapMode = info.mipmapMode,
+        .addressModeU = info.addressModeU,
+        .addressModeV = info.addressModeV,
+        .addressModeW = info.addressModeW,
+        .mipLodBias = info.mipLodBias,
+        .anisotropyEnable = info.anisotropyEnable,
+        .maxAnisotropy = info.maxAnisotropy,
+        .compareEnable = info.compareEnable,
+        .compareOp = info.compareOp,
+        .minLod = info.minLod,
+        .maxLod = info.maxLod,
+        .borderColor = info.borderColor,
+        .unnormalizedCoordinates = info.unnormalizedCoordinates,
+    };
+    auto iter = impl->cache.find(key);
+    if (iter != impl->cache.end()) {
+        ++iter->second.hits;
+        return iter->second.handle;
+    }
+    VkSamplerCreateInfo createInfo = info;
+    createInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    VkSampler sampler;
+    VkResult error = vkCreateSampler(impl->device, &createInfo, VKALLOC, &sampler);
+    LOG_CHECK(not error, "Unable to create sampler.");
+    impl->cache.emplace(key, CacheVal { sampler, 0 });
+    ++impl->misses;
+    return sampler;
+}
+
+LavaSamplerCache::Stats LavaSamplerCache::getStats() const noexcept {
+    auto impl = upcast(this);
+    Stats stats { .samplerCount = (uint32_t) impl->cache.size(), .misses = impl->misses };
+    for (const auto& pair : impl->cache) {
+        stats.hits += pair.second.hits;
+    }
+    return stats;
+}
@@ -0,0 +1,238 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#include <par/LavaLoader.h>
+#include <par/LavaStagingRing.h>
+#include <par/LavaLog.h>
+
+#include <deque>
+#include <vector>
+
+#include "LavaInternal.h"
+
+using namespace par;
+using namespace std;
+
+namespace {
+
+constexpr VkDeviceSize DEFAULT_CAPACITY = 32 * 1024 * 1024;
+
+// Positions are monotonically increasing byte counts. The offset into the buffer is the position
+// modulo the capacity, and the ring is full when head - tail reaches the capacity.
+struct Batch {
+    VkCommandBuffer cmd;
+    VkFence fence;
+    uint64_t end;
+    vector<function<void()>> callbacks;
+};
+
+struct LavaStagingRingImpl : LavaStagingRing {
+    ~LavaStagingRingImpl() noexcept;
+    void retire(bool wait) noexcept;
+    VkDevice device;
+    VkQueue queue;
+    VmaAllocator vma;
+    VkDeviceSize capacity;
+    VkBuffer buffer;
+    VmaAllocation memory;
+    uint8_t* mapped;
+    VkCommandPool pool;
+    VkCommandBuffer recording = VK_NULL_HANDLE;
+    uint64_t head = 0;
+    uint64_t tail = 0;
+    uint64_t submitted = 0;
+    deque<Batch> batches;
+    vector<function<void()>> callbacks;
+    vector<VkCommandBuffer> freeCommandBuffers;
+    vector<VkFence> freeFences;
+};
+
+LAVA_DEFINE_UPCAST(LavaStagingRing)
+
+} // anonymous namespace
+
+LavaStagingRing* LavaStagingRing::create(Config config) noexcept {
+    assert(config.device && config.gpu && config.queue);
+    auto impl = new LavaStagingRingImpl;
+    impl->device = config.device;
+    impl->queue = config.queue;
+    impl->vma = getVma(config.device, config.gpu);
+    impl->capacity = config.capacity ? config.capacity : DEFAULT_CAPACITY;
+
+    // Staging memory is written once and read once, so prefer coherent memory to avoid flushes.
+    // Storage usage allows compute shaders to convert texels in place before they are copied.
+    const VkBufferCreateInfo bufferInfo {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = impl->capacity,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+    };
+    const VmaAllocationCreateInfo allocInfo {
+        .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_CPU_TO_GPU,
+        .requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    };
+    VmaAllocationInfo info;
+    VkResult error = vmaCreateBuffer(impl->vma, &bufferInfo, &allocInfo, &impl->buffer,
+            &impl->memory, &info);
+    LOG_CHECK(not error, "Unable to allocate staging ring.");
+    impl->mapped = (uint8_t*) info.pMappedData;
+    trackMemory(config.device, LAVA_MEMORY_CPU_BUFFER, info.size);
+
+    const VkCommandPoolCreateInfo poolInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .queueFamilyIndex = config.queueFamily,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    };
+    error = vkCreateCommandPool(config.device, &poolInfo, VKALLOC, &impl->pool);
+    LOG_CHECK(not error, "Unable to create command pool.");
+    return impl;
+}
+
+void LavaStagingRing::operator delete(void* ptr) {
+    auto impl = (LavaStagingRingImpl*) ptr;
+    ::delete impl;
+}
+
+LavaStagingRingImpl::~LavaStagingRingImpl() noexcept {
+    finish();
+    for (VkFence fence : freeFences) {
+        vkDestroyFence(device, fence, VKALLOC);
+    }
+    vkDestroyCommandPool(device, pool, VKALLOC);
+    trackMemory(device, LAVA_MEMORY_CPU_BUFFER, -(int64_t) getAllocationSize(vma, memory));
+    vmaDestroyBuffer(vma, buffer, memory);
+}
+
+// Recycles the regions and command buffers of every submission that has completed, in order.
+void LavaStagingRingImpl::retire(bool wait) noexcept {
+    while (!batches.empty()) {
+        Batch& batch = batches.front();
+        if (wait) {
+            vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        } else if (vkGetFenceStatus(device, batch.fence) != VK_SUCCESS) {
+            return;
+        }
+        vkResetFences(device, 1, &batch.fence);
+        freeFences.push_back(batch.fence);
+        for (auto& callback : batch.callbacks) {
+            callback();
+        }
+        if (batch.cmd) {
+            vkResetCommandBuffer(batch.cmd, 0);
+            freeCommandBuffers.push_back(batch.cmd);
+        }
+        tail = batch.end;
+        batches.pop_front();
+        if (wait) {
+            return;
+        }
+    }
+}
+
+LavaStagingRing::Allocation LavaStagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment)
+        noexcept {
+    LavaStagingRingImpl* impl = upcast(this);
+    const VkDeviceSize capacity = impl->capacity;
+    if (size > capacity) {
+        llog.error("Staging request of {} bytes exceeds the ring capacity.", size);
+        return {};
+    }
+    impl->retire(false);
+    while (true) {
+        if (impl->batches.empty() && impl->head == impl->tail) {
+            impl->head = impl->tail = impl->submitted = 0;
+        }
+        // Regions never straddle the end of the buffer, so skip to the start if necessary.
+        const uint64_t base = impl->head - impl->head % capacity;
+        uint64_t offset = impl->head % capacity;
+        offset = (offset + alignment - 1) / alignment * alignment;
+        uint64_t start = base + offset;
+        if (offset + size > capacity) {
+            start = base + capacity;
+        }
+        if (start + size - impl->tail <= capacity) {
+            impl->head = start + size;
+            const VkDeviceSize ringOffset = start % capacity;
+            return {impl->buffer, ringOffset, impl->mapped + ringOffset};
+        }
+        if (impl->batches.empty()) {
+            flush();
+        }
+        impl->retire(true);
+    }
+}
+
+VkCommandBuffer LavaStagingRing::getCommandBuffer() noexcept {
+    LavaStagingRingImpl* impl = upcast(this);
+    if (impl->recording) {
+        return impl->recording;
+    }
+    if (impl->freeCommandBuffers.empty()) {
+        const VkCommandBufferAllocateInfo allocInfo {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = impl->pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        vkAllocateCommandBuffers(impl->device, &allocInfo, &impl->recording);
+    } else {
+        impl->recording = impl->freeCommandBuffers.back();
+        impl->freeCommandBuffers.pop_back();
+    }
+    const VkCommandBufferBeginInfo beginInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(impl->recording, &beginInfo);
+    return impl->recording;
+}
+
+void LavaStagingRing::flush() noexcept {
+    LavaStagingRingImpl* impl = upcast(this);
+    if (impl->head == impl->submitted && !impl->recording && impl->callbacks.empty()) {
+        return;
+    }
+    Batch batch { .cmd = impl->recording, .end = impl->head };
+    swap(batch.callbacks, impl->callbacks);
+    if (impl->freeFences.empty()) {
+        const VkFenceCreateInfo fenceInfo { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+        vkCreateFence(impl->device, &fenceInfo, VKALLOC, &batch.fence);
+    } else {
+        batch.fence = impl->freeFences.back();
+        impl->freeFences.pop_back();
+    }
+
+    // Regions that were allocated without recording any copies are still guarded by a fence,
+    // since the caller might have recorded copies elsewhere.
+    if (batch.cmd) {
+        vkEndCommandBuffer(batch.cmd);
+    }
+    const VkSubmitInfo submitInfo {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = batch.cmd ? 1u : 0u,
+        .pCommandBuffers = &batch.cmd,
+    };
+    VkResult error = vkQueueSubmit(impl->queue, 1, &submitInfo, batch.fence);
+    LOG_CHECK(not error, "Unable to submit staging copies.");
+    impl->batches.push_back(batch);
+    impl->recording = VK_NULL_HANDLE;
+    impl->submitted = impl->head;
+}
+
+void LavaStagingRing::finish() noexcept {
+    LavaStagingRingImpl* impl = upcast(this);
+    flush();
+    while (!impl->batches.empty()) {
+        impl->retire(true);
+    }
+}
+
+void LavaStagingRing::onComplete(function<void()> callback) noexcept {
+    upcast(this)->callbacks.push_back(callback);
+}
+
+VkDeviceSize LavaStagingRing::getCapacity() const noexcept {
+    return upcast(this)->capacity;
+}
@@ -21,7 +21,14 @@ enum AttachmentType {
 
 struct AttachmentImpl : LavaSurfCache::Attachment {
     VmaAllocation mem;
+    VkDeviceMemory external;
+    VkDeviceSize allocationSize;
     AttachmentType type;
+    VkImageCreateInfo imageInfo;
+    VkImageViewCreateInfo viewInfo;
+    VmaAllocationCreateInfo allocInfo;
+    LavaMovable movable;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
 };
 
 struct FbCacheKey {
@@ -29,9 +36,10 @@ struct FbCacheKey {
     LavaSurfCache::Attachment const* depth;
 };
 
-struct FbCacheVal {
+struct FbCacheVal : LavaLruNode {
+    FbCacheVal(VkFramebuffer handle) noexcept : handle(handle) {}
     VkFramebuffer handle;
-    uint64_t timestamp;
+    const FbCacheKey* key = nullptr;
     FbCacheVal(FbCacheVal const&) = delete;
     FbCacheVal& operator=(FbCacheVal const&) = delete;
     FbCacheVal(FbCacheVal &&) = default;
@@ -45,9 +53,10 @@ struct RpCacheKey {
     VkAttachmentLoadOp depthLoad;
 };
 
-struct RpCacheVal {
+struct RpCacheVal : LavaLruNode {
+    RpCacheVal(VkRenderPass handle) noexcept : handle(handle) {}
     VkRenderPass handle;
-    uint64_t timestamp;
+    const RpCacheKey* key = nullptr;
     RpCacheVal(RpCacheVal const&) = delete;
     RpCacheVal& operator=(RpCacheVal const&) = delete;
     RpCacheVal(RpCacheVal &&) = default;
@@ -63,10 +72,17 @@ using FbCache = unordered_map<FbCacheKey, FbCacheVal, FbHashFn, FbIsEqual>;
 using RpCache = unordered_map<RpCacheKey, RpCacheVal, RpHashFn, RpIsEqual>;
 
 struct LavaSurfCacheImpl : LavaSurfCache {
+    AttachmentImpl* createColorAttachment(const AttachmentConfig& config, int importFd)
+            const noexcept;
+    bool relocate(AttachmentImpl* attach, LavaRelocation* reloc) noexcept;
     VkDevice device;
+    VkPhysicalDevice gpu;
     VmaAllocator vma;
     FbCache fbcache;
     RpCache rpcache;
+    LavaCacheClock clock;
+    LavaLruList fblru;
+    LavaLruList rplru;
 };
 
 LAVA_DEFINE_UPCAST(LavaSurfCache)
@@ -76,6 +92,7 @@ LAVA_DEFINE_UPCAST(LavaSurfCache)
 LavaSurfCache* LavaSurfCache::create(const Config& config) noexcept {
     auto impl = new LavaSurfCacheImpl;
     impl->device = config.device;
+    impl->gpu = config.gpu;
     impl->vma = getVma(config.device, config.gpu);
     return impl;
 }
@@ -95,12 +112,31 @@ void LavaSurfCache::operator delete(void* ptr) {
 LavaSurfCache::Attachment const* LavaSurfCache::createColorAttachment(
         const AttachmentConfig& config) const noexcept {
     auto impl = upcast(this);
+    return impl->createColorAttachment(config, -1);
+}
+
+LavaSurfCache::Attachment const* LavaSurfCache::importColorAttachment(
+        const AttachmentConfig& config, int fd) const noexcept {
+    assert(fd >= 0);
+    auto impl = upcast(this);
+    return impl->createColorAttachment(config, fd);
+}
+
+int LavaSurfCache::getAttachmentFd(Attachment const* attachment) const noexcept {
+    auto impl = upcast(this);
+    auto attach = (AttachmentImpl const*) attachment;
+    return getExternalMemoryFd(impl->device, attach->external);
+}
+
+AttachmentImpl* LavaSurfCacheImpl::createColorAttachment(const AttachmentConfig& config,
+        int importFd) const noexcept {
     AttachmentImpl* attach = new AttachmentImpl();
     attach->width = config.width;
     attach->height = config.height;
     attach->format = config.format;
     attach->type = COLOR;
-    VkImageCreateInfo imageInfo {
+    VkImageCreateInfo& imageInfo = attach->imageInfo;
+    imageInfo = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = VK_IMAGE_TYPE_2D,
         .extent = {config.width, config.height, 1},
@@ -112,9 +148,43 @@ LavaSurfCache::Attachment const* LavaSurfCache::createColorAttachment(
                 (config.enableUpload ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : VkImageUsageFlags {}),
         .samples = VK_SAMPLE_COUNT_1_BIT,
     };
-    VmaAllocationCreateInfo allocInfo { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
-    vmaCreateImage(impl->vma, &imageInfo, &allocInfo, &attach->image, &attach->mem, nullptr);
-    VkImageViewCreateInfo colorViewInfo {
+    if (config.exportable || importFd >= 0) {
+        // Shareable memory cannot be sub-allocated by VMA, so it gets its own VkDeviceMemory.
+        const VkExternalMemoryImageCreateInfoKHR externalInfo {
+            .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO_KHR,
+            .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT_KHR,
+        };
+        imageInfo.pNext = &externalInfo;
+        vkCreateImage(device, &imageInfo, VKALLOC, &attach->image);
+        VkMemoryRequirements reqs;
+        vkGetImageMemoryRequirements(device, attach->image, &reqs);
+        attach->external = allocateExternalMemory(device, gpu, reqs, importFd, attach->image);
+        vkBindImageMemory(device, attach->image, attach->external, 0);
+        attach->allocationSize = reqs.size;
+        imageInfo.pNext = nullptr;
+    } else {
+        // Attachments in VMA memory can be moved by LavaDefragmenter, which needs to copy them.
+        imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        attach->allocInfo = { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
+        const LavaMemoryPool pool = config.pool == LavaMemoryPool::AUTO ?
+                LavaMemoryPool::ATTACHMENT : config.pool;
+        createPooledImage(device, vma, pool, imageInfo, &attach->allocInfo, &attach->image,
+                &attach->mem);
+        attach->allocationSize = getAllocationSize(vma, attach->mem);
+        // The relocation callback mutates the framebuffer cache, which is not const.
+        auto impl = const_cast<LavaSurfCacheImpl*>(this);
+        attach->movable = {
+            .allocation = &attach->mem,
+            .pool = attach->allocInfo.pool,
+            .relocate = [impl, attach] (LavaRelocation* reloc) {
+                return impl->relocate(attach, reloc);
+            }
+        };
+        registerMovable(device, &attach->movable);
+    }
+    trackMemory(device, LAVA_MEMORY_ATTACHMENT, attach->allocationSize);
+    VkImageViewCreateInfo& colorViewInfo = attach->viewInfo;
+    colorViewInfo = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .image = attach->image,
         .viewType = VK_IMAGE_VIEW_TYPE_2D,
@@ -125,7 +195,7 @@ LavaSurfCache::Attachment const* LavaSurfCache::createColorAttachment(
             .layerCount = 1
         }
     };
-    vkCreateImageView(impl->device, &colorViewInfo, VKALLOC, &attach->imageView);
+    vkCreateImageView(device, &colorViewInfo, VKALLOC, &attach->imageView);
     return attach;
 }
 
@@ -144,6 +214,7 @@ void LavaSurfCache::finalizeAttachment(Attachment const* attachment,
     };
     vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    ((AttachmentImpl*) attachment)->layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 }
 
 void LavaSurfCache::finalizeAttachment(Attachment const* attachment, VkCommandBuffer cmdbuf,
@@ -190,6 +261,7 @@ void LavaSurfCache::finalizeAttachment(Attachment const* attachment, VkCommandBu
             &clearColor, 1, &range);
     vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier2);
+    ((AttachmentImpl*) attachment)->layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 }
 
 void LavaSurfCache::finalizeAttachment(Attachment const* attachment, VkCommandBuffer cmdbuf,
@@ -245,16 +317,63 @@ void LavaSurfCache::finalizeAttachment(Attachment const* attachment, VkCommandBu
             1, &upload);
     vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier2);
+    ((AttachmentImpl*) attachment)->layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+}
+
+void LavaSurfCache::setAttachmentLayout(Attachment const* attachment,
+        VkImageLayout layout) const noexcept {
+    ((AttachmentImpl*) attachment)->layout = layout;
 }
 
 void LavaSurfCache::freeAttachment(Attachment const* attachment) const noexcept {
     auto impl = upcast(this);
-    auto attach = (AttachmentImpl const*) attachment;
-    vmaDestroyImage(impl->vma, attach->image, attach->mem);
+    auto attach = (AttachmentImpl*) attachment;
+    trackMemory(impl->device, LAVA_MEMORY_ATTACHMENT, -(int64_t) attach->allocationSize);
+    if (attach->external) {
+        vkDestroyImage(impl->device, attach->image, VKALLOC);
+        vkFreeMemory(impl->device, attach->external, VKALLOC);
+    } else {
+        unregisterMovable(impl->device, &attach->movable);
+        vmaDestroyImage(impl->vma, attach->image, attach->mem);
+    }
     vkDestroyImageView(impl->device, attach->imageView, VKALLOC);
     delete attach;
 }
 
+// Moves the attachment to a different memory block, preserving its most recently known layout.
+// Attachments that were never finalized have no contents, so their replacement is not copied.
+// Framebuffers that refer to the old image view are evicted since they would otherwise be stale.
+bool LavaSurfCacheImpl::relocate(AttachmentImpl* attach, LavaRelocation* reloc) noexcept {
+    VkImage newImage;
+    VmaAllocation newMemory;
+    if (!createRelocatedImage(vma, attach->imageInfo, attach->allocInfo, reloc, &newImage,
+            &newMemory)) {
+        return false;
+    }
+    if (attach->layout != VK_IMAGE_LAYOUT_UNDEFINED) {
+        recordImageMove(reloc->cmd, attach->image, newImage, attach->layout,
+                attach->imageInfo.extent, 1, 1);
+    }
+    reloc->images.emplace_back(attach->image, attach->mem);
+    reloc->views.push_back(attach->imageView);
+    reloc->oldView = attach->imageView;
+    attach->viewInfo.image = attach->image = newImage;
+    attach->mem = newMemory;
+    vkCreateImageView(device, &attach->viewInfo, VKALLOC, &attach->imageView);
+    reloc->newView = attach->imageView;
+    using FbIter = decltype(fbcache)::const_iterator;
+    for (FbIter iter = fbcache.begin(); iter != fbcache.end();) {
+        if (iter->first.color == attach || iter->first.depth == attach) {
+            reloc->framebuffers.push_back(iter->second.handle);
+            fblru.remove((FbCacheVal*) &iter->second);
+            iter = fbcache.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    return true;
+}
+
 VkFramebuffer LavaSurfCache::getFramebuffer(const Params& params) noexcept {
     assert(params.color && !params.depth && "Not yet implemented.");
     const uint32_t width = params.color ? params.color->width : params.depth->width;
@@ -264,10 +383,13 @@ VkFramebuffer LavaSurfCache::getFramebuffer(const Params& params) noexcept {
         .color = params.color,
         .depth = params.depth,
     };
+
+    // Render passes created by the cache leave the color attachment ready for sampling.
+    ((AttachmentImpl*) params.color)->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     auto iter = impl->fbcache.find(key);
     if (iter != impl->fbcache.end()) {
         FbCacheVal* val = (FbCacheVal*) &(iter->second);
-        val->timestamp = getCurrentTime();
+        impl->fblru.touch(val, impl->clock);
         return val->handle;
     }
     VkImageView attachments[2];
@@ -289,7 +411,9 @@ VkFramebuffer LavaSurfCache::getFramebuffer(const Params& params) noexcept {
     };
     VkFramebuffer framebuffer;
     vkCreateFramebuffer(impl->device, &info, VKALLOC, &framebuffer);
-    impl->fbcache.emplace(make_pair(key, FbCacheVal {framebuffer, getCurrentTime()}));
+    iter = impl->fbcache.emplace(make_pair(key, FbCacheVal(framebuffer))).first;
+    iter->second.key = &iter->first;
+    impl->fblru.touch(&iter->second, impl->clock);
     return framebuffer;
 }
 
@@ -314,7 +438,7 @@ VkRenderPass LavaSurfCache::getRenderPass(const Params& params, VkRenderPassBegi
     };
     if (iter != impl->rpcache.end()) {
         RpCacheVal* val = (RpCacheVal*) &(iter->second);
-        val->timestamp = getCurrentTime();
+        impl->rplru.touch(val, impl->clock);
         if (rpbi) {
             info.framebuffer = getFramebuffer(params);
             info.renderPass = val->handle;
@@ -356,7 +480,9 @@ VkRenderPass LavaSurfCache::getRenderPass(const Params& params, VkRenderPassBegi
     };
     VkRenderPass renderPass;
     vkCreateRenderPass(impl->device, &rpinfo, VKALLOC, &renderPass);
-    impl->rpcache.emplace(make_pair(key, RpCacheVal {renderPass, getCurrentTime()}));
+    iter = impl->rpcache.emplace(make_pair(key, RpCacheVal(renderPass))).first;
+    iter->second.key = &iter->first;
+    impl->rplru.touch(&iter->second, impl->clock);
     if (rpbi) {
         info.framebuffer = getFramebuffer(params);
         info.renderPass = renderPass;
@@ -367,31 +493,31 @@ VkRenderPass LavaSurfCache::getRenderPass(const Params& params, VkRenderPassBegi
 
 void LavaSurfCache::releaseUnused(uint64_t milliseconds) noexcept {
     LavaSurfCacheImpl* impl = upcast(this);
-    const uint64_t expiration = getCurrentTime() - milliseconds;
-    auto& fbcache = impl->fbcache;
-    using FbIter = decltype(impl->fbcache)::const_iterator;
-    for (FbIter iter = fbcache.begin(); iter != fbcache.end();) {
-        if (iter->second.timestamp < expiration) {
-            VkFramebuffer fb = iter->second.handle;
-            vkDestroyFramebuffer(impl->device, fb, VKALLOC);
-            iter = fbcache.erase(iter);
-        } else {
-            ++iter;
+    const uint64_t expiration = impl->clock.now() - milliseconds;
+    while (LavaLruNode* node = impl->fblru.oldest()) {
+        FbCacheVal* val = static_cast<FbCacheVal*>(node);
+        if (val->timeMs >= expiration) {
+            break;
         }
+        impl->fblru.remove(val);
+        vkDestroyFramebuffer(impl->device, val->handle, VKALLOC);
+        impl->fbcache.erase(impl->fbcache.find(*val->key));
     }
-    auto& rpcache = impl->rpcache;
-    using RpIter = decltype(impl->rpcache)::const_iterator;
-    for (RpIter iter = rpcache.begin(); iter != rpcache.end();) {
-        if (iter->second.timestamp < expiration) {
-            LAVA_UNUSED VkRenderPass rp = iter->second.handle;
-            vkDestroyRenderPass(impl->device, rp, VKALLOC);
-            iter = rpcache.erase(iter);
-        } else {
-            ++iter;
+    while (LavaLruNode* node = impl->rplru.oldest()) {
+        RpCacheVal* val = static_cast<RpCacheVal*>(node);
+        if (val->timeMs >= expiration) {
+            break;
         }
+        impl->rplru.remove(val);
+        vkDestroyRenderPass(impl->device, val->handle, VKALLOC);
+        impl->rpcache.erase(impl->rpcache.find(*val->key));
     }
 }
 
+void LavaSurfCache::tick() noexcept {
+    upcast(this)->clock.tick();
+}
+
 bool FbIsEqual::operator()(const FbCacheKey& a, const FbCacheKey& b) const {
     return a.color == b.color && a.depth == b.depth;
 }
@@ -5,152 +5,1355 @@
 #include <par/LavaTexture.h>
 #include <par/LavaLog.h>
 
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
 #include "LavaInternal.h"
 
 using namespace par;
+using namespace std;
+
+namespace {
+
+// Pointers to the contents of each mip level, starting with level 0.
+struct SourceLevels {
+    vector<uint8_t const*> data;
+    vector<VkDeviceSize> sizes;
+};
+
+struct KtxImage {
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    SourceLevels levels;
+};
+
+// Offsets into the stage must be a multiple of 4 and of the texel block size.
+constexpr VkDeviceSize STAGE_LEVEL_ALIGNMENT = 16;
+
+const uint8_t KTX1_IDENTIFIER[12] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+
+const uint8_t KTX2_IDENTIFIER[12] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+
+struct Ktx1Header {
+    uint8_t identifier[12];
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct Ktx2Level {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// KTX1 files use OpenGL enums, so we only recognize the formats that are common in practice.
+struct GlFormat {
+    uint32_t glInternalFormat;
+    VkFormat vkFormat;
+};
+
+const GlFormat KTX1_FORMATS[] = {
+    {0x8058, VK_FORMAT_R8G8B8A8_UNORM},
+    {0x8C43, VK_FORMAT_R8G8B8A8_SRGB},
+    {0x83F0, VK_FORMAT_BC1_RGB_UNORM_BLOCK},
+    {0x83F1, VK_FORMAT_BC1_RGBA_UNORM_BLOCK},
+    {0x83F2, VK_FORMAT_BC2_UNORM_BLOCK},
+    {0x83F3, VK_FORMAT_BC3_UNORM_BLOCK},
+    {0x8C4D, VK_FORMAT_BC1_RGBA_SRGB_BLOCK},
+    {0x8C4E, VK_FORMAT_BC2_SRGB_BLOCK},
+    {0x8C4F, VK_FORMAT_BC3_SRGB_BLOCK},
+    {0x8DBB, VK_FORMAT_BC4_UNORM_BLOCK},
+    {0x8DBD, VK_FORMAT_BC5_UNORM_BLOCK},
+    {0x8E8C, VK_FORMAT_BC7_UNORM_BLOCK},
+    {0x8E8D, VK_FORMAT_BC7_SRGB_BLOCK},
+    {0x8E8F, VK_FORMAT_BC6H_UFLOAT_BLOCK},
+    {0x9274, VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK},
+    {0x9275, VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK},
+    {0x9278, VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK},
+    {0x9279, VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK},
+    {0x93B0, VK_FORMAT_ASTC_4x4_UNORM_BLOCK},
+    {0x93B7, VK_FORMAT_ASTC_8x8_UNORM_BLOCK},
+    {0x93D0, VK_FORMAT_ASTC_4x4_SRGB_BLOCK},
+    {0x93D7, VK_FORMAT_ASTC_8x8_SRGB_BLOCK},
+};
+
+// Texel blocks of the formats that KTX files commonly contain. Uncompressed formats have 1x1
+// blocks.
+struct FormatBlock {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes;
+};
+
+const uint8_t ASTC_BLOCK_SIZES[][2] = {
+    {4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6}, {8, 8}, {10, 5}, {10, 6}, {10, 8},
+    {10, 10}, {12, 10}, {12, 12},
+};
+
+bool getFormatBlock(VkFormat format, FormatBlock* block) {
+    auto inRange = [format] (VkFormat first, VkFormat last) {
+        return format >= first && format <= last;
+    };
+    *block = {1, 1, 0};
+    if (format == VK_FORMAT_R4G4_UNORM_PACK8 || inRange(VK_FORMAT_R8_UNORM, VK_FORMAT_R8_SRGB)) {
+        block->bytes = 1;
+    } else if (inRange(VK_FORMAT_R4G4B4A4_UNORM_PACK16, VK_FORMAT_A1R5G5B5_UNORM_PACK16) ||
+            inRange(VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8_SRGB) ||
+            inRange(VK_FORMAT_R16_UNORM, VK_FORMAT_R16_SFLOAT)) {
+        block->bytes = 2;
+    } else if (inRange(VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_B8G8R8_SRGB)) {
+        block->bytes = 3;
+    } else if (inRange(VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_A2B10G10R10_SINT_PACK32) ||
+            inRange(VK_FORMAT_R16G16_UNORM, VK_FORMAT_R16G16_SFLOAT) ||
+            inRange(VK_FORMAT_R32_UINT, VK_FORMAT_R32_SFLOAT) ||
+            inRange(VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_E5B9G9R9_UFLOAT_PACK32)) {
+        block->bytes = 4;
+    } else if (inRange(VK_FORMAT_R16G16B16_UNORM, VK_FORMAT_R16G16B16_SFLOAT)) {
+        block->bytes = 6;
+    } else if (inRange(VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16B16A16_SFLOAT) ||
+            inRange(VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32_SFLOAT)) {
+        block->bytes = 8;
+    } else if (inRange(VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32_SFLOAT)) {
+        block->bytes = 12;
+    } else if (inRange(VK_FORMAT_R32G32B32A32_UINT, VK_FORMAT_R32G32B32A32_SFLOAT)) {
+        block->bytes = 16;
+    } else if (inRange(VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC1_RGBA_SRGB_BLOCK) ||
+            inRange(VK_FORMAT_BC4_UNORM_BLOCK, VK_FORMAT_BC4_SNORM_BLOCK) ||
+            inRange(VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK) ||
+            inRange(VK_FORMAT_EAC_R11_UNORM_BLOCK, VK_FORMAT_EAC_R11_SNORM_BLOCK)) {
+        *block = {4, 4, 8};
+    } else if (inRange(VK_FORMAT_BC2_UNORM_BLOCK, VK_FORMAT_BC3_SRGB_BLOCK) ||
+            inRange(VK_FORMAT_BC5_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK) ||
+            inRange(VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK) ||
+            inRange(VK_FORMAT_EAC_R11G11_UNORM_BLOCK, VK_FORMAT_EAC_R11G11_SNORM_BLOCK)) {
+        *block = {4, 4, 16};
+    } else if (inRange(VK_FORMAT_ASTC_4x4_UNORM_BLOCK, VK_FORMAT_ASTC_12x12_SRGB_BLOCK)) {
+        const uint8_t* dims = ASTC_BLOCK_SIZES[(format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2];
+        *block = {dims[0], dims[1], 16};
+    }
+    return block->bytes > 0;
+}
+
+// Rejects files whose mip levels are too small to fill the image, which would otherwise make the
+// upload read past the end of each level.
+bool checkLevelSizes(const KtxImage& image) {
+    FormatBlock block;
+    if (!getFormatBlock(image.format, &block)) {
+        llog.error("Unsupported KTX format {}.", (int) image.format);
+        return false;
+    }
+    uint32_t maxLevels = 1;
+    while (maxLevels < 32 && (std::max(image.width, image.height) >> maxLevels) > 0) {
+        ++maxLevels;
+    }
+    if (image.levels.sizes.size() > maxLevels) {
+        llog.error("KTX file has too many mip levels.");
+        return false;
+    }
+    for (size_t level = 0; level < image.levels.sizes.size(); ++level) {
+        const uint64_t width = std::max(image.width >> level, 1u);
+        const uint64_t height = std::max(image.height >> level, 1u);
+        const uint64_t rowPitch = (width + block.width - 1) / block.width * block.bytes;
+        const uint64_t rowCount = (height + block.height - 1) / block.height;
+        if (image.levels.sizes[level] < rowPitch * rowCount) {
+            llog.error("KTX level {} is truncated.", level);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseKtx1(uint8_t const* data, size_t size, KtxImage* result) {
+    Ktx1Header header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.endianness != 0x04030201) {
+        llog.error("Big-endian KTX files are not supported.");
+        return false;
+    }
+    if (header.pixelDepth > 1 || header.numberOfArrayElements > 1 || header.numberOfFaces > 1) {
+        llog.error("Only 2D KTX textures are supported.");
+        return false;
+    }
+    result->format = VK_FORMAT_UNDEFINED;
+    for (const GlFormat& fmt : KTX1_FORMATS) {
+        if (fmt.glInternalFormat == header.glInternalFormat) {
+            result->format = fmt.vkFormat;
+        }
+    }
+    if (result->format == VK_FORMAT_UNDEFINED) {
+        llog.error("Unknown KTX internal format {:x}.", header.glInternalFormat);
+        return false;
+    }
+    result->width = header.pixelWidth;
+    result->height = std::max(header.pixelHeight, 1u);
+    const uint32_t levelCount = std::max(header.numberOfMipmapLevels, 1u);
+    size_t offset = sizeof(header) + header.bytesOfKeyValueData;
+    for (uint32_t level = 0; level < levelCount; ++level) {
+        uint32_t imageSize;
+        if (offset + sizeof(imageSize) > size) {
+            return false;
+        }
+        memcpy(&imageSize, data + offset, sizeof(imageSize));
+        offset += sizeof(imageSize);
+        if (imageSize > size - offset) {
+            return false;
+        }
+        result->levels.data.push_back(data + offset);
+        result->levels.sizes.push_back(imageSize);
+        offset += (imageSize + 3) & ~3u;
+    }
+    return true;
+}
+
+bool parseKtx2(uint8_t const* data, size_t size, KtxImage* result) {
+    Ktx2Header header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.supercompressionScheme != 0) {
+        llog.error("Supercompressed KTX2 files are not supported.");
+        return false;
+    }
+    if (header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount > 1) {
+        llog.error("Only 2D KTX2 textures are supported.");
+        return false;
+    }
+    result->format = (VkFormat) header.vkFormat;
+    result->width = header.pixelWidth;
+    result->height = std::max(header.pixelHeight, 1u);
+    const uint32_t levelCount = std::max(header.levelCount, 1u);
+    if (sizeof(header) + levelCount * sizeof(Ktx2Level) > size) {
+        return false;
+    }
+    for (uint32_t level = 0; level < levelCount; ++level) {
+        Ktx2Level index;
+        memcpy(&index, data + sizeof(header) + level * sizeof(index), sizeof(index));
+        if (index.byteOffset > size || index.byteLength > size - index.byteOffset) {
+            return false;
+        }
+        result->levels.data.push_back(data + index.byteOffset);
+        result->levels.sizes.push_back(index.byteLength);
+    }
+    return true;
+}
+
+bool parseKtx(void const* ktxData, size_t ktxSize, KtxImage* result) {
+    auto data = (uint8_t const*) ktxData;
+    if (ktxSize >= sizeof(KTX1_IDENTIFIER) && !memcmp(data, KTX1_IDENTIFIER, 12)) {
+        return parseKtx1(data, ktxSize, result) && checkLevelSizes(*result);
+    }
+    if (ktxSize >= sizeof(KTX2_IDENTIFIER) && !memcmp(data, KTX2_IDENTIFIER, 12)) {
+        return parseKtx2(data, ktxSize, result) && checkLevelSizes(*result);
+    }
+    llog.error("Unrecognized KTX identifier.");
+    return false;
+}
+
+// Formats that the conversion shader understands. Each channel names the offset of its first byte
+// within the texel, or one of the fill values. Channels are either 8 or 16 bits wide.
+constexpr uint8_t FILL_ZERO = 8;
+constexpr uint8_t FILL_ONE = 9;
+
+struct ByteFormat {
+    VkFormat format;
+    uint32_t bytes;
+    uint32_t channelBytes;
+    bool srgb;
+    uint8_t channels[4];
+};
+
+const ByteFormat BYTE_FORMATS[] = {
+    {VK_FORMAT_R8_UNORM, 1, 1, false, {0, FILL_ZERO, FILL_ZERO, FILL_ONE}},
+    {VK_FORMAT_R8_SRGB, 1, 1, true, {0, FILL_ZERO, FILL_ZERO, FILL_ONE}},
+    {VK_FORMAT_R8G8_UNORM, 2, 1, false, {0, 1, FILL_ZERO, FILL_ONE}},
+    {VK_FORMAT_R8G8_SRGB, 2, 1, true, {0, 1, FILL_ZERO, FILL_ONE}},
+    {VK_FORMAT_R8G8B8_UNORM, 3, 1, false, {0, 1, 2, FILL_ONE}},
+    {VK_FORMAT_R8G8B8_SRGB, 3, 1, true, {0, 1, 2, FILL_ONE}},
+    {VK_FORMAT_B8G8R8_UNORM, 3, 1, false, {2, 1, 0, FILL_ONE}},
+    {VK_FORMAT_B8G8R8_SRGB, 3, 1, true, {2, 1, 0, FILL_ONE}},
+    {VK_FORMAT_R8G8B8A8_UNORM, 4, 1, false, {0, 1, 2, 3}},
+    {VK_FORMAT_R8G8B8A8_SRGB, 4, 1, true, {0, 1, 2, 3}},
+    {VK_FORMAT_B8G8R8A8_UNORM, 4, 1, false, {2, 1, 0, 3}},
+    {VK_FORMAT_B8G8R8A8_SRGB, 4, 1, true, {2, 1, 0, 3}},
+    {VK_FORMAT_R16_UNORM, 2, 2, false, {0, FILL_ZERO, FILL_ZERO, FILL_ONE}},
+    {VK_FORMAT_R16G16_UNORM, 4, 2, false, {0, 2, FILL_ZERO, FILL_ONE}},
+    {VK_FORMAT_R16G16B16_UNORM, 6, 2, false, {0, 2, 4, FILL_ONE}},
+    {VK_FORMAT_R16G16B16A16_UNORM, 8, 2, false, {0, 2, 4, 6}},
+};
+
+const ByteFormat* findByteFormat(VkFormat format) {
+    for (const ByteFormat& fmt : BYTE_FORMATS) {
+        if (fmt.format == format) {
+            return &fmt;
+        }
+    }
+    return nullptr;
+}
+
+// Packs the source channel (or fill value) for each byte of a four-byte destination texel.
+uint32_t getSelectors(VkFormat sourceFormat, VkFormat format) {
+    const ByteFormat* source = findByteFormat(sourceFormat);
+    const ByteFormat* dest = findByteFormat(format);
+    uint32_t selectors = 0;
+    for (uint32_t channel = 0; channel < 4; ++channel) {
+        selectors |= uint32_t(source->channels[channel]) << (dest->channels[channel] * 8);
+    }
+    return selectors;
+}
+
+// Bit 0 selects 16-bit source channels, and bits 8 through 11 select the destination bytes that
+// are encoded as sRGB. Linear sources encode their color channels, but never alpha.
+uint32_t getConvertFlags(VkFormat sourceFormat, VkFormat format) {
+    const ByteFormat* source = findByteFormat(sourceFormat);
+    const ByteFormat* dest = findByteFormat(format);
+    uint32_t flags = source->channelBytes == 2 ? 1 : 0;
+    if (dest->srgb && !source->srgb) {
+        for (uint32_t channel = 0; channel < 3; ++channel) {
+            flags |= 1u << (8 + dest->channels[channel]);
+        }
+    }
+    return flags;
+}
+
+// SPIR-V for the following compute shader, assembled by hand since the core library cannot depend
+// on a shader compiler. Each invocation expands one texel, and the byte offsets into the stage
+// must be multiples of 4.
+//
+//     #version 450
+//     layout(local_size_x = 64) in;
+//     layout(std430, binding = 0) readonly buffer Source { uint src[]; };
+//     layout(std430, binding = 1) writeonly buffer Dest { uint dst[]; };
+//     layout(push_constant) uniform Params {
+//         uint srcOffset, dstOffset, srcTexelBytes, selectors, firstTexel, texelCount, flags;
+//     };
+//     void main() {
+//         uint texel = firstTexel + gl_GlobalInvocationID.x;
+//         if (texel < texelCount) {
+//             uint base = srcOffset + texel * srcTexelBytes;
+//             bool wide = (flags & 1) != 0;
+//             uint mask = wide ? 0xffff : 0xff;
+//             float scale = wide ? 1.0 / 65535.0 : 1.0 / 255.0;
+//             uint result = 0;
+//             for (uint c = 0; c < 4; ++c) {   // unrolled
+//                 uint sel = (selectors >> (c * 8)) & 0xff;
+//                 uint b = base + (sel < 8 ? sel : 0);
+//                 float f = float((src[b >> 2] >> ((b & 3) << 3)) & mask) * scale;
+//                 float srgb = f <= 0.0031308 ? f * 12.92 : pow(f, 1.0 / 2.4) * 1.055 - 0.055;
+//                 f = ((flags >> (8 + c)) & 1) != 0 ? srgb : f;
+//                 uint value = sel < 8 ? uint(f * 255.0 + 0.5) : (sel == 9 ? 0xff : 0);
+//                 result |= value << (c * 8);
+//             }
+//             dst[(dstOffset >> 2) + texel] = result;
+//         }
+//     }
+const uint32_t CONVERT_SPIRV[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x000000cd, 0x00000000, 0x00020011, 0x00000001, 0x0006000b,
+    0x00000014, 0x4c534c47, 0x6474732e, 0x3035342e, 0x00000000, 0x0003000e, 0x00000000, 0x00000001,
+    0x0006000f, 0x00000005, 0x00000001, 0x6e69616d, 0x00000000, 0x00000002, 0x00060010, 0x00000001,
+    0x00000011, 0x00000040, 0x00000001, 0x00000001, 0x00040047, 0x00000002, 0x0000000b, 0x0000001c,
+    0x00040047, 0x0000000a, 0x00000006, 0x00000004, 0x00050048, 0x0000000b, 0x00000000, 0x00000023,
+    0x00000000, 0x00030047, 0x0000000b, 0x00000003, 0x00040047, 0x00000011, 0x00000022, 0x00000000,
+    0x00040047, 0x00000011, 0x00000021, 0x00000000, 0x00040047, 0x00000012, 0x00000022, 0x00000000,
+    0x00040047, 0x00000012, 0x00000021, 0x00000001, 0x00050048, 0x0000000e, 0x00000000, 0x00000023,
+    0x00000000, 0x00050048, 0x0000000e, 0x00000001, 0x00000023, 0x00000004, 0x00050048, 0x0000000e,
+    0x00000002, 0x00000023, 0x00000008, 0x00050048, 0x0000000e, 0x00000003, 0x00000023, 0x0000000c,
+    0x00050048, 0x0000000e, 0x00000004, 0x00000023, 0x00000010, 0x00050048, 0x0000000e, 0x00000005,
+    0x00000023, 0x00000014, 0x00050048, 0x0000000e, 0x00000006, 0x00000023, 0x00000018, 0x00030047,
+    0x0000000e, 0x00000002, 0x00020013, 0x00000003, 0x00030021, 0x00000004, 0x00000003, 0x00020014,
+    0x00000005, 0x00040015, 0x00000006, 0x00000020, 0x00000000, 0x00040015, 0x00000007, 0x00000020,
+    0x00000001, 0x00030016, 0x00000015, 0x00000020, 0x00040017, 0x00000008, 0x00000006, 0x00000003,
+    0x00040020, 0x00000009, 0x00000001, 0x00000008, 0x0004003b, 0x00000009, 0x00000002, 0x00000001,
+    0x0003001d, 0x0000000a, 0x00000006, 0x0003001e, 0x0000000b, 0x0000000a, 0x00040020, 0x0000000c,
+    0x00000002, 0x0000000b, 0x0004003b, 0x0000000c, 0x00000011, 0x00000002, 0x0004003b, 0x0000000c,
+    0x00000012, 0x00000002, 0x00040020, 0x0000000d, 0x00000002, 0x00000006, 0x0009001e, 0x0000000e,
+    0x00000006, 0x00000006, 0x00000006, 0x00000006, 0x00000006, 0x00000006, 0x00000006, 0x00040020,
+    0x0000000f, 0x00000009, 0x0000000e, 0x0004003b, 0x0000000f, 0x00000013, 0x00000009, 0x00040020,
+    0x00000010, 0x00000009, 0x00000006, 0x0004002b, 0x00000006, 0x00000016, 0x00000000, 0x0004002b,
+    0x00000006, 0x00000017, 0x00000001, 0x0004002b, 0x00000006, 0x00000018, 0x00000002, 0x0004002b,
+    0x00000006, 0x00000019, 0x00000003, 0x0004002b, 0x00000006, 0x0000001a, 0x00000008, 0x0004002b,
+    0x00000006, 0x0000001b, 0x00000009, 0x0004002b, 0x00000006, 0x0000001c, 0x00000010, 0x0004002b,
+    0x00000006, 0x0000001d, 0x00000018, 0x0004002b, 0x00000006, 0x0000001e, 0x000000ff, 0x0004002b,
+    0x00000006, 0x0000001f, 0x0000ffff, 0x0004002b, 0x00000006, 0x00000020, 0x0000000a, 0x0004002b,
+    0x00000006, 0x00000021, 0x0000000b, 0x0004002b, 0x00000007, 0x00000022, 0x00000000, 0x0004002b,
+    0x00000007, 0x00000023, 0x00000001, 0x0004002b, 0x00000007, 0x00000024, 0x00000002, 0x0004002b,
+    0x00000007, 0x00000025, 0x00000003, 0x0004002b, 0x00000007, 0x00000026, 0x00000004, 0x0004002b,
+    0x00000007, 0x00000027, 0x00000005, 0x0004002b, 0x00000007, 0x00000028, 0x00000006, 0x0004002b,
+    0x00000015, 0x00000029, 0x3b808081, 0x0004002b, 0x00000015, 0x0000002a, 0x37800080, 0x0004002b,
+    0x00000015, 0x0000002b, 0x414eb852, 0x0004002b, 0x00000015, 0x0000002c, 0x3f870a3d, 0x0004002b,
+    0x00000015, 0x0000002d, 0x3d6147ae, 0x0004002b, 0x00000015, 0x0000002e, 0x3ed55555, 0x0004002b,
+    0x00000015, 0x0000002f, 0x3b4d2e1c, 0x0004002b, 0x00000015, 0x00000030, 0x437f0000, 0x0004002b,
+    0x00000015, 0x00000031, 0x3f000000, 0x00050036, 0x00000003, 0x00000001, 0x00000000, 0x00000004,
+    0x000200f8, 0x00000032, 0x0004003d, 0x00000008, 0x00000035, 0x00000002, 0x00050051, 0x00000006,
+    0x00000036, 0x00000035, 0x00000000, 0x00050041, 0x00000010, 0x00000037, 0x00000013, 0x00000026,
+    0x0004003d, 0x00000006, 0x00000038, 0x00000037, 0x00050080, 0x00000006, 0x00000039, 0x00000038,
+    0x00000036, 0x00050041, 0x00000010, 0x0000003a, 0x00000013, 0x00000027, 0x0004003d, 0x00000006,
+    0x0000003b, 0x0000003a, 0x000500b0, 0x00000005, 0x0000003c, 0x00000039, 0x0000003b, 0x000300f7,
+    0x00000034, 0x00000000, 0x000400fa, 0x0000003c, 0x00000033, 0x00000034, 0x000200f8, 0x00000033,
+    0x00050041, 0x00000010, 0x0000003d, 0x00000013, 0x00000022, 0x0004003d, 0x00000006, 0x0000003e,
+    0x0000003d, 0x00050041, 0x00000010, 0x0000003f, 0x00000013, 0x00000023, 0x0004003d, 0x00000006,
+    0x00000040, 0x0000003f, 0x00050041, 0x00000010, 0x00000041, 0x00000013, 0x00000024, 0x0004003d,
+    0x00000006, 0x00000042, 0x00000041, 0x00050041, 0x00000010, 0x00000043, 0x00000013, 0x00000025,
+    0x0004003d, 0x00000006, 0x00000044, 0x00000043, 0x00050041, 0x00000010, 0x00000045, 0x00000013,
+    0x00000028, 0x0004003d, 0x00000006, 0x00000046, 0x00000045, 0x00050084, 0x00000006, 0x00000047,
+    0x00000039, 0x00000042, 0x00050080, 0x00000006, 0x00000048, 0x0000003e, 0x00000047, 0x000500c7,
+    0x00000006, 0x00000049, 0x00000046, 0x00000017, 0x000500ab, 0x00000005, 0x0000004a, 0x00000049,
+    0x00000016, 0x000600a9, 0x00000006, 0x0000004b, 0x0000004a, 0x0000001f, 0x0000001e, 0x000600a9,
+    0x00000015, 0x0000004c, 0x0000004a, 0x0000002a, 0x00000029, 0x000500c7, 0x00000006, 0x0000004d,
+    0x00000044, 0x0000001e, 0x000500b0, 0x00000005, 0x0000004e, 0x0000004d, 0x0000001a, 0x000600a9,
+    0x00000006, 0x0000004f, 0x0000004e, 0x0000004d, 0x00000016, 0x00050080, 0x00000006, 0x00000050,
+    0x00000048, 0x0000004f, 0x000500c2, 0x00000006, 0x00000051, 0x00000050, 0x00000018, 0x00060041,
+    0x0000000d, 0x00000052, 0x00000011, 0x00000022, 0x00000051, 0x0004003d, 0x00000006, 0x00000053,
+    0x00000052, 0x000500c7, 0x00000006, 0x00000054, 0x00000050, 0x00000019, 0x000500c4, 0x00000006,
+    0x00000055, 0x00000054, 0x00000019, 0x000500c2, 0x00000006, 0x00000056, 0x00000053, 0x00000055,
+    0x000500c7, 0x00000006, 0x00000057, 0x00000056, 0x0000004b, 0x00040070, 0x00000015, 0x00000058,
+    0x00000057, 0x00050085, 0x00000015, 0x00000059, 0x00000058, 0x0000004c, 0x00050085, 0x00000015,
+    0x0000005a, 0x00000059, 0x0000002b, 0x0007000c, 0x00000015, 0x0000005b, 0x00000014, 0x0000001a,
+    0x00000059, 0x0000002e, 0x00050085, 0x00000015, 0x0000005c, 0x0000005b, 0x0000002c, 0x00050083,
+    0x00000015, 0x0000005d, 0x0000005c, 0x0000002d, 0x000500bc, 0x00000005, 0x0000005e, 0x00000059,
+    0x0000002f, 0x000600a9, 0x00000015, 0x0000005f, 0x0000005e, 0x0000005a, 0x0000005d, 0x000500c2,
+    0x00000006, 0x00000060, 0x00000046, 0x0000001a, 0x000500c7, 0x00000006, 0x00000061, 0x00000060,
+    0x00000017, 0x000500ab, 0x00000005, 0x00000062, 0x00000061, 0x00000016, 0x000600a9, 0x00000015,
+    0x00000063, 0x00000062, 0x0000005f, 0x00000059, 0x00050085, 0x00000015, 0x00000064, 0x00000063,
+    0x00000030, 0x00050081, 0x00000015, 0x00000065, 0x00000064, 0x00000031, 0x0004006d, 0x00000006,
+    0x00000066, 0x00000065, 0x000500aa, 0x00000005, 0x00000067, 0x0000004d, 0x0000001b, 0x000600a9,
+    0x00000006, 0x00000068, 0x00000067, 0x0000001e, 0x00000016, 0x000600a9, 0x00000006, 0x00000069,
+    0x0000004e, 0x00000066, 0x00000068, 0x000500c2, 0x00000006, 0x0000006a, 0x00000044, 0x0000001a,
+    0x000500c7, 0x00000006, 0x0000006b, 0x0000006a, 0x0000001e, 0x000500b0, 0x00000005, 0x0000006c,
+    0x0000006b, 0x0000001a, 0x000600a9, 0x00000006, 0x0000006d, 0x0000006c, 0x0000006b, 0x00000016,
+    0x00050080, 0x00000006, 0x0000006e, 0x00000048, 0x0000006d, 0x000500c2, 0x00000006, 0x0000006f,
+    0x0000006e, 0x00000018, 0x00060041, 0x0000000d, 0x00000070, 0x00000011, 0x00000022, 0x0000006f,
+    0x0004003d, 0x00000006, 0x00000071, 0x00000070, 0x000500c7, 0x00000006, 0x00000072, 0x0000006e,
+    0x00000019, 0x000500c4, 0x00000006, 0x00000073, 0x00000072, 0x00000019, 0x000500c2, 0x00000006,
+    0x00000074, 0x00000071, 0x00000073, 0x000500c7, 0x00000006, 0x00000075, 0x00000074, 0x0000004b,
+    0x00040070, 0x00000015, 0x00000076, 0x00000075, 0x00050085, 0x00000015, 0x00000077, 0x00000076,
+    0x0000004c, 0x00050085, 0x00000015, 0x00000078, 0x00000077, 0x0000002b, 0x0007000c, 0x00000015,
+    0x00000079, 0x00000014, 0x0000001a, 0x00000077, 0x0000002e, 0x00050085, 0x00000015, 0x0000007a,
+    0x00000079, 0x0000002c, 0x00050083, 0x00000015, 0x0000007b, 0x0000007a, 0x0000002d, 0x000500bc,
+    0x00000005, 0x0000007c, 0x00000077, 0x0000002f, 0x000600a9, 0x00000015, 0x0000007d, 0x0000007c,
+    0x00000078, 0x0000007b, 0x000500c2, 0x00000006, 0x0000007e, 0x00000046, 0x0000001b, 0x000500c7,
+    0x00000006, 0x0000007f, 0x0000007e, 0x00000017, 0x000500ab, 0x00000005, 0x00000080, 0x0000007f,
+    0x00000016, 0x000600a9, 0x00000015, 0x00000081, 0x00000080, 0x0000007d, 0x00000077, 0x00050085,
+    0x00000015, 0x00000082, 0x00000081, 0x00000030, 0x00050081, 0x00000015, 0x00000083, 0x00000082,
+    0x00000031, 0x0004006d, 0x00000006, 0x00000084, 0x00000083, 0x000500aa, 0x00000005, 0x00000085,
+    0x0000006b, 0x0000001b, 0x000600a9, 0x00000006, 0x00000086, 0x00000085, 0x0000001e, 0x00000016,
+    0x000600a9, 0x00000006, 0x00000087, 0x0000006c, 0x00000084, 0x00000086, 0x000500c4, 0x00000006,
+    0x00000088, 0x00000087, 0x0000001a, 0x000500c5, 0x00000006, 0x00000089, 0x00000069, 0x00000088,
+    0x000500c2, 0x00000006, 0x0000008a, 0x00000044, 0x0000001c, 0x000500c7, 0x00000006, 0x0000008b,
+    0x0000008a, 0x0000001e, 0x000500b0, 0x00000005, 0x0000008c, 0x0000008b, 0x0000001a, 0x000600a9,
+    0x00000006, 0x0000008d, 0x0000008c, 0x0000008b, 0x00000016, 0x00050080, 0x00000006, 0x0000008e,
+    0x00000048, 0x0000008d, 0x000500c2, 0x00000006, 0x0000008f, 0x0000008e, 0x00000018, 0x00060041,
+    0x0000000d, 0x00000090, 0x00000011, 0x00000022, 0x0000008f, 0x0004003d, 0x00000006, 0x00000091,
+    0x00000090, 0x000500c7, 0x00000006, 0x00000092, 0x0000008e, 0x00000019, 0x000500c4, 0x00000006,
+    0x00000093, 0x00000092, 0x00000019, 0x000500c2, 0x00000006, 0x00000094, 0x00000091, 0x00000093,
+    0x000500c7, 0x00000006, 0x00000095, 0x00000094, 0x0000004b, 0x00040070, 0x00000015, 0x00000096,
+    0x00000095, 0x00050085, 0x00000015, 0x00000097, 0x00000096, 0x0000004c, 0x00050085, 0x00000015,
+    0x00000098, 0x00000097, 0x0000002b, 0x0007000c, 0x00000015, 0x00000099, 0x00000014, 0x0000001a,
+    0x00000097, 0x0000002e, 0x00050085, 0x00000015, 0x0000009a, 0x00000099, 0x0000002c, 0x00050083,
+    0x00000015, 0x0000009b, 0x0000009a, 0x0000002d, 0x000500bc, 0x00000005, 0x0000009c, 0x00000097,
+    0x0000002f, 0x000600a9, 0x00000015, 0x0000009d, 0x0000009c, 0x00000098, 0x0000009b, 0x000500c2,
+    0x00000006, 0x0000009e, 0x00000046, 0x00000020, 0x000500c7, 0x00000006, 0x0000009f, 0x0000009e,
+    0x00000017, 0x000500ab, 0x00000005, 0x000000a0, 0x0000009f, 0x00000016, 0x000600a9, 0x00000015,
+    0x000000a1, 0x000000a0, 0x0000009d, 0x00000097, 0x00050085, 0x00000015, 0x000000a2, 0x000000a1,
+    0x00000030, 0x00050081, 0x00000015, 0x000000a3, 0x000000a2, 0x00000031, 0x0004006d, 0x00000006,
+    0x000000a4, 0x000000a3, 0x000500aa, 0x00000005, 0x000000a5, 0x0000008b, 0x0000001b, 0x000600a9,
+    0x00000006, 0x000000a6, 0x000000a5, 0x0000001e, 0x00000016, 0x000600a9, 0x00000006, 0x000000a7,
+    0x0000008c, 0x000000a4, 0x000000a6, 0x000500c4, 0x00000006, 0x000000a8, 0x000000a7, 0x0000001c,
+    0x000500c5, 0x00000006, 0x000000a9, 0x00000089, 0x000000a8, 0x000500c2, 0x00000006, 0x000000aa,
+    0x00000044, 0x0000001d, 0x000500c7, 0x00000006, 0x000000ab, 0x000000aa, 0x0000001e, 0x000500b0,
+    0x00000005, 0x000000ac, 0x000000ab, 0x0000001a, 0x000600a9, 0x00000006, 0x000000ad, 0x000000ac,
+    0x000000ab, 0x00000016, 0x00050080, 0x00000006, 0x000000ae, 0x00000048, 0x000000ad, 0x000500c2,
+    0x00000006, 0x000000af, 0x000000ae, 0x00000018, 0x00060041, 0x0000000d, 0x000000b0, 0x00000011,
+    0x00000022, 0x000000af, 0x0004003d, 0x00000006, 0x000000b1, 0x000000b0, 0x000500c7, 0x00000006,
+    0x000000b2, 0x000000ae, 0x00000019, 0x000500c4, 0x00000006, 0x000000b3, 0x000000b2, 0x00000019,
+    0x000500c2, 0x00000006, 0x000000b4, 0x000000b1, 0x000000b3, 0x000500c7, 0x00000006, 0x000000b5,
+    0x000000b4, 0x0000004b, 0x00040070, 0x00000015, 0x000000b6, 0x000000b5, 0x00050085, 0x00000015,
+    0x000000b7, 0x000000b6, 0x0000004c, 0x00050085, 0x00000015, 0x000000b8, 0x000000b7, 0x0000002b,
+    0x0007000c, 0x00000015, 0x000000b9, 0x00000014, 0x0000001a, 0x000000b7, 0x0000002e, 0x00050085,
+    0x00000015, 0x000000ba, 0x000000b9, 0x0000002c, 0x00050083, 0x00000015, 0x000000bb, 0x000000ba,
+    0x0000002d, 0x000500bc, 0x00000005, 0x000000bc, 0x000000b7, 0x0000002f, 0x000600a9, 0x00000015,
+    0x000000bd, 0x000000bc, 0x000000b8, 0x000000bb, 0x000500c2, 0x00000006, 0x000000be, 0x00000046,
+    0x00000021, 0x000500c7, 0x00000006, 0x000000bf, 0x000000be, 0x00000017, 0x000500ab, 0x00000005,
+    0x000000c0, 0x000000bf, 0x00000016, 0x000600a9, 0x00000015, 0x000000c1, 0x000000c0, 0x000000bd,
+    0x000000b7, 0x00050085, 0x00000015, 0x000000c2, 0x000000c1, 0x00000030, 0x00050081, 0x00000015,
+    0x000000c3, 0x000000c2, 0x00000031, 0x0004006d, 0x00000006, 0x000000c4, 0x000000c3, 0x000500aa,
+    0x00000005, 0x000000c5, 0x000000ab, 0x0000001b, 0x000600a9, 0x00000006, 0x000000c6, 0x000000c5,
+    0x0000001e, 0x00000016, 0x000600a9, 0x00000006, 0x000000c7, 0x000000ac, 0x000000c4, 0x000000c6,
+    0x000500c4, 0x00000006, 0x000000c8, 0x000000c7, 0x0000001d, 0x000500c5, 0x00000006, 0x000000c9,
+    0x000000a9, 0x000000c8, 0x000500c2, 0x00000006, 0x000000ca, 0x00000040, 0x00000018, 0x00050080,
+    0x00000006, 0x000000cb, 0x000000ca, 0x00000039, 0x00060041, 0x0000000d, 0x000000cc, 0x00000012,
+    0x00000022, 0x000000cb, 0x0003003e, 0x000000cc, 0x000000c9, 0x000200f9, 0x00000034, 0x000200f8,
+    0x00000034, 0x000100fd, 0x00010038,
+};
+
+constexpr uint32_t CONVERT_GROUP_SIZE = 64;
+constexpr uint64_t CONVERT_TEXELS_PER_DISPATCH = 65535 * CONVERT_GROUP_SIZE;
+
+struct ConvertParams {
+    uint32_t srcOffset;
+    uint32_t dstOffset;
+    uint32_t srcTexelBytes;
+    uint32_t selectors;
+    uint32_t firstTexel;
+    uint32_t texelCount;
+    uint32_t flags;
+};
+
+// Every converted texture on a device shares one compute pipeline, which is destroyed when the
+// last conversion that uses it has completed.
+struct Converter {
+    VkDevice device;
+    VkDescriptorSetLayout setLayout;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    uint32_t refs;
+};
+
+mutex sConverterMutex;
+vector<Converter> sConverters;
+
+Converter acquireConverter(VkDevice device) {
+    lock_guard<mutex> lock(sConverterMutex);
+    for (Converter& converter : sConverters) {
+        if (converter.device == device) {
+            ++converter.refs;
+            return converter;
+        }
+    }
+    Converter converter { .device = device, .refs = 1 };
+    const VkDescriptorSetLayoutBinding bindings[2] = {{
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    }, {
+        .binding = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    }};
+    const VkDescriptorSetLayoutCreateInfo setLayoutInfo {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindings = bindings,
+    };
+    vkCreateDescriptorSetLayout(device, &setLayoutInfo, VKALLOC, &converter.setLayout);
+    const VkPushConstantRange range {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .size = sizeof(ConvertParams),
+    };
+    const VkPipelineLayoutCreateInfo pipelineLayoutInfo {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &converter.setLayout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &range,
+    };
+    vkCreatePipelineLayout(device, &pipelineLayoutInfo, VKALLOC, &converter.pipelineLayout);
+    const VkShaderModuleCreateInfo moduleInfo {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = sizeof(CONVERT_SPIRV),
+        .pCode = CONVERT_SPIRV,
+    };
+    VkShaderModule module;
+    VkResult error = vkCreateShaderModule(device, &moduleInfo, VKALLOC, &module);
+    LOG_CHECK(not error, "Unable to create the texture conversion shader.");
+    const VkComputePipelineCreateInfo pipelineInfo {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = module,
+            .pName = "main",
+        },
+        .layout = converter.pipelineLayout,
+    };
+    error = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, VKALLOC,
+            &converter.pipeline);
+    LOG_CHECK(not error, "Unable to create the texture conversion pipeline.");
+    vkDestroyShaderModule(device, module, VKALLOC);
+    sConverters.push_back(converter);
+    return converter;
+}
+
+void releaseConverter(VkDevice device) {
+    lock_guard<mutex> lock(sConverterMutex);
+    for (auto iter = sConverters.begin(); iter != sConverters.end(); ++iter) {
+        if (iter->device == device) {
+            if (--iter->refs == 0) {
+                vkDestroyPipeline(device, iter->pipeline, VKALLOC);
+                vkDestroyPipelineLayout(device, iter->pipelineLayout, VKALLOC);
+                vkDestroyDescriptorSetLayout(device, iter->setLayout, VKALLOC);
+                sConverters.erase(iter);
+            }
+            return;
+        }
+    }
+}
+
+// Destroys the descriptors of a conversion once the GPU has finished executing it.
+void releaseConversion(VkDevice device, VkDescriptorPool pool) {
+    vkDestroyDescriptorPool(device, pool, VKALLOC);
+    releaseConverter(device);
+}
+
+// Conversions bind the stage from its start, so a ring can only hold them if the shader is able
+// to address all of it.
+bool fitsStorageRange(VkPhysicalDevice gpu, VkDeviceSize size) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(gpu, &props);
+    return size <= props.limits.maxStorageBufferRange;
+}
+
+// Returns the number of levels in the mip chain, which is 1 unless mipmaps are requested.
+uint32_t countMipLevels(const LavaTexture::Config& config) {
+    uint32_t mipLevels = 1;
+    if (config.mipmaps) {
+        for (uint32_t dim = std::max(config.width, config.height); dim > 1; dim >>= 1) {
+            ++mipLevels;
+        }
+    }
+    return mipLevels;
+}
+
+// Returns the total number of texels in the raw source levels that are used by the texture.
+uint64_t countSourceTexels(const LavaTexture::Config& config, uint32_t sourceMips) {
+    uint64_t texelCount = 0;
+    for (uint32_t level = 0; level < sourceMips; ++level) {
+        texelCount += std::max(config.width >> level, 1u) * std::max(config.height >> level, 1u);
+    }
+    return texelCount;
+}
+
+} // anonymous namespace
 
 struct LavaTextureImpl : LavaTexture {
-    LavaTextureImpl(Config config) noexcept;
+    LavaTextureImpl(Config config, const SourceLevels* levels = nullptr) noexcept;
     ~LavaTextureImpl() noexcept;
     VkDevice device;
-    VmaAllocation stageMem;
+    VmaAllocation stageMem = VK_NULL_HANDLE;
     VmaAllocation imageMem;
     VmaAllocator vma;
     VkFormat format;
     VkExtent3D size;
-    VkBuffer stage;
+    uint32_t sourceMips;
+    vector<VkDeviceSize> levelOffsets;
+    VkDeviceSize texelSize = 0;
+    VkDeviceSize stageAlignment;
+    LavaStagingRing* staging;
+    vector<uint8_t> pendingTexels;
+    vector<VkBufferImageCopy> pendingCopies;
+    VkBuffer updateStage = VK_NULL_HANDLE;
+    VmaAllocation updateStageMem = VK_NULL_HANDLE;
+    bool converted = false;
+    uint32_t convertSelectors;
+    uint32_t convertFlags;
+    VkDeviceSize convertOffset;
+    VkDeviceSize convertTexels;
+    mutable VkDescriptorPool convertPool = VK_NULL_HANDLE;
+    mutable VkDescriptorSet convertSet;
+    mutable Converter converter;
+    VkFilter mipFilter;
+    VkBuffer stage = VK_NULL_HANDLE;
     VkImage image;
     VkImageView view;
-    void uploadStage(VkCommandBuffer cmd) const noexcept;
+    VkImageCreateInfo imageInfo;
+    VkImageViewCreateInfo viewInfo;
+    VmaAllocationCreateInfo allocInfo;
+    LavaMovable movable;
+    LavaBindlessSet* bindless;
+    uint32_t bindlessIndex = LavaBindlessSet::INVALID_INDEX;
+    bool ringStaged = false;
+    mutable bool uploaded = false;
+    void uploadStage(VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset) const noexcept;
+    void uploadUpdates(VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset) noexcept;
+    void recordConversion(VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset)
+            const noexcept;
+    void freeUpdateStage() noexcept;
+    void freeConversion() noexcept;
+    bool relocate(LavaRelocation* reloc) noexcept;
 };
 
 LAVA_DEFINE_UPCAST(LavaTexture)
 
 LavaTexture* LavaTexture::create(Config config) noexcept {
+    // Raw sources with several levels, a writer, or a conversion need to know the texel size. A
+    // single level of any other size is staged as an opaque block of bytes.
+    const bool convert = config.sourceFormat && config.sourceFormat != config.format;
+    const uint32_t sourceMips = std::max(std::min(config.sourceMips, countMipLevels(config)), 1u);
+    if ((sourceMips > 1 || config.writer || convert) &&
+            config.size % countSourceTexels(config, sourceMips)) {
+        llog.error("Size {} does not match the provided levels.", config.size);
+        return nullptr;
+    }
+    if (!convert) {
+        return new LavaTextureImpl(config);
+    }
+    if (!canConvert(config.gpu, config.sourceFormat, config.format)) {
+        llog.error("Unable to convert from format {} to {}.", (int) config.sourceFormat,
+                (int) config.format);
+        return nullptr;
+    }
+
+    // The conversion shader addresses the source and the converted texels in a single binding.
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(config.gpu, &props);
+    const uint64_t texelCount = config.size / findByteFormat(config.sourceFormat)->bytes;
+    if (config.size + STAGE_LEVEL_ALIGNMENT + texelCount * 4 >
+            props.limits.maxStorageBufferRange) {
+        llog.error("Texture is too large to convert on the GPU.");
+        return nullptr;
+    }
     return new LavaTextureImpl(config);
 }
 
+LavaTexture* LavaTexture::createFromKtx(Config config, void const* ktxData, size_t ktxSize)
+        noexcept {
+    KtxImage ktx;
+    if (!parseKtx(ktxData, ktxSize, &ktx)) {
+        return nullptr;
+    }
+    if (chooseFormat(config.gpu, {ktx.format}) == VK_FORMAT_UNDEFINED) {
+        llog.error("KTX format {} is not supported by this GPU.", (int) ktx.format);
+        return nullptr;
+    }
+    config.source = nullptr;
+    config.sourceFormat = VK_FORMAT_UNDEFINED;
+    config.width = ktx.width;
+    config.height = ktx.height;
+    config.format = ktx.format;
+    config.mipmaps = ktx.levels.data.size() > 1;
+    return new LavaTextureImpl(config, &ktx.levels);
+}
+
+VkFormat LavaTexture::getKtxFormat(void const* ktxData, size_t ktxSize) noexcept {
+    KtxImage ktx;
+    return parseKtx(ktxData, ktxSize, &ktx) ? ktx.format : VK_FORMAT_UNDEFINED;
+}
+
+VkFormat LavaTexture::chooseFormat(VkPhysicalDevice gpu, const vector<VkFormat>& candidates)
+        noexcept {
+    for (VkFormat format : candidates) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(gpu, format, &props);
+        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) {
+            return format;
+        }
+    }
+    return VK_FORMAT_UNDEFINED;
+}
+
+bool LavaTexture::canConvert(VkPhysicalDevice gpu, VkFormat sourceFormat, VkFormat format)
+        noexcept {
+    const ByteFormat* source = findByteFormat(sourceFormat);
+    const ByteFormat* dest = findByteFormat(format);
+    if (!source || !dest || dest->bytes != 4 || dest->channelBytes != 1 ||
+            (source->srgb && !dest->srgb)) {
+        return false;
+    }
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(gpu, format, &props);
+    return props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+}
+
 void LavaTexture::operator delete(void* ptr) noexcept {
     auto impl = (LavaTextureImpl*) ptr;
     ::delete impl;
 }
 
 LavaTextureImpl::~LavaTextureImpl() noexcept {
+    if (bindlessIndex == LavaBindlessSet::INVALID_INDEX) {
+        unregisterMovable(device, &movable);
+    }
+    if (bindless) {
+        bindless->unregisterImage(bindlessIndex);
+    }
+    if (stageMem) {
+        trackMemory(device, LAVA_MEMORY_TEXTURE, -(int64_t) getAllocationSize(vma, stageMem));
+    }
+    trackMemory(device, LAVA_MEMORY_TEXTURE, -(int64_t) getAllocationSize(vma, imageMem));
     vmaDestroyBuffer(vma, stage, stageMem);
+    freeUpdateStage();
+    freeConversion();
     vmaDestroyImage(vma, image, imageMem);
     vkDestroyImageView(device, view, VKALLOC);
 }
 
-LavaTextureImpl::LavaTextureImpl(Config config) noexcept : device(config.device) {
-    assert(config.device && config.gpu && config.size > 0);
+LavaTextureImpl::LavaTextureImpl(Config config, const SourceLevels* levels) noexcept :
+        device(config.device) {
+    assert(config.device && config.gpu && (levels || config.size > 0));
     format = config.format;
     size = { config.width, config.height, 1 };
     vma = getVma(config.device, config.gpu);
+
+    // Determine the number of levels, which is limited to the provided levels if the format
+    // cannot be used with vkCmdBlitImage. Prefer linear filtering when the format allows it.
+    uint32_t mipLevels = countMipLevels(config);
+    if (levels) {
+        config.sourceMips = (uint32_t) levels->data.size();
+    }
+    sourceMips = std::max(std::min(config.sourceMips, mipLevels), 1u);
+    VkFormatProperties formatProps;
+    vkGetPhysicalDeviceFormatProperties(config.gpu, format, &formatProps);
+    const VkFormatFeatureFlags features = formatProps.optimalTilingFeatures;
+    mipFilter = VK_FILTER_NEAREST;
+    if (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) {
+        mipFilter = VK_FILTER_LINEAR;
+    }
+    constexpr VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+            VK_FORMAT_FEATURE_BLIT_DST_BIT;
+    if (mipLevels > sourceMips && (features & blitFeatures) != blitFeatures) {
+        llog.warn("Format {} does not support blits, skipping mipmap generation.", (int) format);
+        mipLevels = sourceMips;
+    }
+
+    // Determine where each level lives in the stage. Raw sources are tightly packed, so we infer
+    // the texel size from the total size, while pre-compressed levels are aligned individually.
+    // A single raw level whose size is not a multiple of the texel count has no known texel size,
+    // so it is staged as an opaque block and cannot be partially updated.
+    VkDeviceSize stageSize = 0;
+    staging = config.staging ? config.staging : getDefaultStagingRing(device);
+    stageAlignment = STAGE_LEVEL_ALIGNMENT;
+    levelOffsets.resize(sourceMips);
+    if (levels) {
+        for (uint32_t level = 0; level < sourceMips; ++level) {
+            levelOffsets[level] = stageSize;
+            stageSize += levels->sizes[level];
+            stageSize = (stageSize + STAGE_LEVEL_ALIGNMENT - 1) & ~(STAGE_LEVEL_ALIGNMENT - 1);
+        }
+    } else {
+        const VkDeviceSize texelCount = countSourceTexels(config, sourceMips);
+        if (config.size % texelCount == 0) {
+            texelSize = config.size / texelCount;
+            stageAlignment = texelSize % 4 == 0 ? texelSize : texelSize % 2 == 0 ?
+                    texelSize * 2 : texelSize * 4;
+        }
+        assert((texelSize || sourceMips == 1) && "Size does not match the provided levels.");
+        for (uint32_t level = 0; level < sourceMips; ++level) {
+            levelOffsets[level] = countSourceTexels(config, level) * texelSize;
+        }
+        stageSize = config.size;
+
+        // Texels in a different format are expanded by a compute shader, which writes four bytes
+        // per texel after the source texels. The copy into the image then reads from there.
+        if (config.sourceFormat && config.sourceFormat != format) {
+            LOG_CHECK(!config.externalStage, "Converted textures require an internal stage.");
+            converted = true;
+            convertSelectors = getSelectors(config.sourceFormat, format);
+            convertFlags = getConvertFlags(config.sourceFormat, format);
+            convertOffset = (stageSize + STAGE_LEVEL_ALIGNMENT - 1) &
+                    ~(STAGE_LEVEL_ALIGNMENT - 1);
+            convertTexels = texelCount;
+            stageSize = convertOffset + texelCount * 4;
+        }
+    }
+
     VkBufferCreateInfo bufferInfo {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = config.size,
+        .size = stageSize,
         .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
     };
-    VkImageCreateInfo imageInfo {
+    if (converted) {
+        bufferInfo.usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    }
+    imageInfo = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = VK_IMAGE_TYPE_2D,
         .extent = size,
         .format = format,
-        .mipLevels = 1,
+        .mipLevels = mipLevels,
         .arrayLayers = 1,
-        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
         .samples = VK_SAMPLE_COUNT_1_BIT,
     };
-    VmaAllocationCreateInfo stageInfo { .usage = VMA_MEMORY_USAGE_CPU_TO_GPU };
-    vmaCreateBuffer(vma, &bufferInfo, &stageInfo, &stage, &stageMem, nullptr);
-    if (config.source) {
-        void* mappedData;
-        vmaMapMemory(vma, stageMem, &mappedData);
+    // Prefer the staging ring, falling back to a dedicated stage for texels that do not fit.
+    LavaStagingRing::Allocation ringRegion {};
+    uint8_t* mappedData = nullptr;
+    if (config.externalStage) {
+        assert(!levels && !config.source && !config.staging);
+        LOG_CHECK(!config.writer, "Writers require a stage, so they cannot use externalStage.");
+    } else if (staging && stageSize <= staging->getCapacity() &&
+            (!converted || fitsStorageRange(config.gpu, staging->getCapacity()))) {
+        ringRegion = staging->allocate(stageSize, stageAlignment);
+        mappedData = ringRegion.mapped;
+    }
+    if (!config.externalStage && !mappedData) {
+        VmaAllocationCreateInfo stageInfo { .usage = VMA_MEMORY_USAGE_CPU_TO_GPU };
+        createPooledBuffer(device, vma, LavaMemoryPool::STAGING, bufferInfo, &stageInfo, &stage,
+                &stageMem);
+        trackMemory(device, LAVA_MEMORY_TEXTURE, getAllocationSize(vma, stageMem));
+        vmaMapMemory(vma, stageMem, (void**) &mappedData);
+    }
+    if (mappedData && config.writer) {
+        assert(!levels && !config.source);
+        for (uint32_t level = 0; level < sourceMips; ++level) {
+            const uint32_t rowPitch = std::max(config.width >> level, 1u) * (uint32_t) texelSize;
+            config.writer(mappedData + levelOffsets[level], level, rowPitch);
+        }
+    } else if (mappedData && levels) {
+        for (uint32_t level = 0; level < sourceMips; ++level) {
+            memcpy(mappedData + levelOffsets[level], levels->data[level], levels->sizes[level]);
+        }
+    } else if (mappedData && config.source) {
         memcpy(mappedData, config.source, config.size);
+    }
+    if (stageMem) {
         vmaUnmapMemory(vma, stageMem);
     }
-    VmaAllocationCreateInfo allocInfo { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
-    vmaCreateImage(vma, &imageInfo, &allocInfo, &image, &imageMem, nullptr);
+    allocInfo = { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
+    const LavaMemoryPool pool = config.pool == LavaMemoryPool::AUTO ? LavaMemoryPool::TEXTURE :
+            config.pool;
+    createPooledImage(device, vma, pool, imageInfo, &allocInfo, &image, &imageMem);
+    trackMemory(device, LAVA_MEMORY_TEXTURE, getAllocationSize(vma, imageMem));
 
-    VkImageViewCreateInfo colorViewInfo {
+    viewInfo = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .image = image,
         .viewType = VK_IMAGE_VIEW_TYPE_2D,
         .format = format,
+        .components = config.swizzle,
         .subresourceRange = {
             .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .levelCount = 1,
+            .levelCount = mipLevels,
             .layerCount = 1
         }
     };
-    vkCreateImageView(config.device, &colorViewInfo, VKALLOC, &view);
+    vkCreateImageView(config.device, &viewInfo, VKALLOC, &view);
+    bindless = config.bindless;
+    if (bindless) {
+        bindlessIndex = bindless->registerImage(view);
+    }
+
+    // Shared stages are recycled as soon as the ring's copies complete, so record them now.
+    if (ringRegion.mapped) {
+        ringStaged = true;
+        uploadStage(staging->getCommandBuffer(), ringRegion.buffer, ringRegion.offset);
+    }
+
+    // Bindless slots cannot be rewritten while frames in flight may sample them, so textures that
+    // have a slot are never moved.
+    if (bindlessIndex != LavaBindlessSet::INVALID_INDEX) {
+        return;
+    }
+    movable = {
+        .allocation = &imageMem,
+        .pool = allocInfo.pool,
+        .relocate = [this] (LavaRelocation* reloc) { return relocate(reloc); }
+    };
+    registerMovable(device, &movable);
+}
+
+bool LavaTextureImpl::relocate(LavaRelocation* reloc) noexcept {
+    // Textures that haven't been uploaded yet have nothing to copy.
+    if (!uploaded) {
+        return false;
+    }
+    VkImage newImage;
+    VmaAllocation newMemory;
+    if (!createRelocatedImage(vma, imageInfo, allocInfo, reloc, &newImage, &newMemory)) {
+        return false;
+    }
+    recordImageMove(reloc->cmd, image, newImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            imageInfo.extent, imageInfo.mipLevels, imageInfo.arrayLayers);
+    reloc->images.emplace_back(image, imageMem);
+    reloc->views.push_back(view);
+    reloc->oldView = view;
+    viewInfo.image = image = newImage;
+    imageMem = newMemory;
+    vkCreateImageView(device, &viewInfo, VKALLOC, &view);
+    reloc->newView = view;
+    return true;
+}
+
+// Copies all levels that were provided in the stage, then generates the remaining levels by
+// repeatedly blitting from the previous level. Levels that are only written are left in
+// TRANSFER_DST, and levels that have been blitted from are left in TRANSFER_SRC, which allows the
+// final transition to SHADER_READ_ONLY to be done with a single pipeline barrier.
+void LavaTextureImpl::uploadStage(VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset)
+        const noexcept {
+    const uint32_t levels = imageInfo.mipLevels;
+    auto barrier = [this] (uint32_t baseLevel, uint32_t levelCount, VkImageLayout oldLayout,
+            VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+        return VkImageMemoryBarrier {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .image = image,
+            .oldLayout = oldLayout,
+            .newLayout = newLayout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = baseLevel,
+                .levelCount = levelCount,
+                .layerCount = 1,
+            },
+            .srcAccessMask = srcAccess,
+            .dstAccessMask = dstAccess
+        };
+    };
+    auto extent = [this] (uint32_t level) {
+        return VkExtent3D {
+            .width = std::max(size.width >> level, 1u),
+            .height = std::max(size.height >> level, 1u),
+            .depth = 1,
+        };
+    };
+
+    const VkImageMemoryBarrier barrier1 = barrier(0, levels, VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier1);
+
+    // Converted textures are copied from the output of the conversion shader, which has the same
+    // layout as the source texels except that every texel is four bytes wide.
+    if (converted) {
+        recordConversion(cmd, buffer, offset);
+    }
+
+    vector<VkBufferImageCopy> uploads(sourceMips);
+    for (uint32_t level = 0; level < sourceMips; ++level) {
+        const VkDeviceSize levelOffset = converted ?
+                convertOffset + levelOffsets[level] / texelSize * 4 : levelOffsets[level];
+        uploads[level] = {
+            .bufferOffset = offset + levelOffset,
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .layerCount = 1,
+            },
+            .imageExtent = extent(level),
+        };
+    }
+    vkCmdCopyBufferToImage(cmd, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            sourceMips, uploads.data());
+
+    for (uint32_t level = sourceMips; level < levels; ++level) {
+        const VkImageMemoryBarrier toSource = barrier(level - 1, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &toSource);
+        const VkExtent3D srcSize = extent(level - 1);
+        const VkExtent3D dstSize = extent(level);
+        const VkImageBlit blit {
+            .srcSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level - 1,
+                .layerCount = 1,
+            },
+            .srcOffsets = {{0, 0, 0}, {(int32_t) srcSize.width, (int32_t) srcSize.height, 1}},
+            .dstSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .layerCount = 1,
+            },
+            .dstOffsets = {{0, 0, 0}, {(int32_t) dstSize.width, (int32_t) dstSize.height, 1}},
+        };
+        vkCmdBlitImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, mipFilter);
+    }
+
+    // Every generated level was blitted from its predecessor, so levels in the range
+    // [sourceMips - 1, levels - 1) are now in TRANSFER_SRC while the others are in TRANSFER_DST.
+    VkImageMemoryBarrier barriers[3];
+    uint32_t nbarriers = 0;
+    const uint32_t blitSources = levels - sourceMips;
+    const uint32_t writtenOnly = blitSources ? sourceMips - 1 : levels;
+    if (writtenOnly > 0) {
+        barriers[nbarriers++] = barrier(0, writtenOnly,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+    if (blitSources > 0) {
+        barriers[nbarriers++] = barrier(writtenOnly, blitSources,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT);
+        barriers[nbarriers++] = barrier(levels - 1, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, nbarriers, barriers);
+    uploaded = true;
+}
+
+VkImageView LavaTexture::getImageView() const noexcept {
+    return upcast(this)->view;
+}
+
+uint32_t LavaTexture::getBindlessIndex() const noexcept {
+    return upcast(this)->bindlessIndex;
+}
+
+void LavaTextureImpl::freeUpdateStage() noexcept {
+    if (updateStageMem) {
+        trackMemory(device, LAVA_MEMORY_TEXTURE, -(int64_t) getAllocationSize(vma, updateStageMem));
+    }
+    vmaDestroyBuffer(vma, updateStage, updateStageMem);
+    updateStage = VK_NULL_HANDLE;
+    updateStageMem = VK_NULL_HANDLE;
+}
+
+void LavaTextureImpl::freeConversion() noexcept {
+    if (convertPool) {
+        releaseConversion(device, convertPool);
+    }
+    convertPool = VK_NULL_HANDLE;
+}
+
+// Records a dispatch of the conversion shader over every source texel in the stage. Conversions
+// staged in a ring release their descriptors when the ring's copies complete, while the others
+// keep them until the stage is freed, since the stage can be uploaded more than once.
+void LavaTextureImpl::recordConversion(VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset)
+        const noexcept {
+    const VkDeviceSize dstOffset = offset + convertOffset;
+    if (!convertPool) {
+        converter = acquireConverter(device);
+        const VkDescriptorPoolSize poolSize {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 2,
+        };
+        const VkDescriptorPoolCreateInfo poolInfo {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .maxSets = 1,
+            .poolSizeCount = 1,
+            .pPoolSizes = &poolSize,
+        };
+        vkCreateDescriptorPool(device, &poolInfo, VKALLOC, &convertPool);
+        const VkDescriptorSetAllocateInfo allocInfo {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = convertPool,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &converter.setLayout,
+        };
+        vkAllocateDescriptorSets(device, &allocInfo, &convertSet);
+        const VkDescriptorBufferInfo bufferInfo {
+            .buffer = buffer,
+            .range = dstOffset + convertTexels * 4,
+        };
+        VkWriteDescriptorSet writes[2] = {{
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = convertSet,
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &bufferInfo,
+        }};
+        writes[1] = writes[0];
+        writes[1].dstBinding = 1;
+        vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+    }
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, converter.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, converter.pipelineLayout, 0, 1,
+            &convertSet, 0, nullptr);
+    ConvertParams params {
+        .srcOffset = (uint32_t) offset,
+        .dstOffset = (uint32_t) dstOffset,
+        .srcTexelBytes = (uint32_t) texelSize,
+        .selectors = convertSelectors,
+        .texelCount = (uint32_t) convertTexels,
+        .flags = convertFlags,
+    };
+    for (uint64_t first = 0; first < convertTexels; first += CONVERT_TEXELS_PER_DISPATCH) {
+        const uint64_t count = std::min(convertTexels - first, CONVERT_TEXELS_PER_DISPATCH);
+        params.firstTexel = (uint32_t) first;
+        vkCmdPushConstants(cmd, converter.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                sizeof(params), &params);
+        vkCmdDispatch(cmd, (uint32_t) ((count + CONVERT_GROUP_SIZE - 1) / CONVERT_GROUP_SIZE),
+                1, 1);
+    }
+    const VkBufferMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = buffer,
+        .offset = dstOffset,
+        .size = convertTexels * 4,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    if (ringStaged) {
+        const VkDevice device = this->device;
+        const VkDescriptorPool pool = convertPool;
+        staging->onComplete([device, pool] { releaseConversion(device, pool); });
+        convertPool = VK_NULL_HANDLE;
+    }
 }
 
-void LavaTextureImpl::uploadStage(VkCommandBuffer cmd) const noexcept {
-    const int miplevel = 0;
-    VkImageMemoryBarrier barrier1 {
+// Copies every pending rectangle with a single command. The image is transitioned back to the
+// transfer layout from SHADER_READ_ONLY rather than UNDEFINED so that untouched texels are kept.
+void LavaTextureImpl::uploadUpdates(VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset)
+        noexcept {
+    for (VkBufferImageCopy& copy : pendingCopies) {
+        copy.bufferOffset += offset;
+    }
+    VkImageMemoryBarrier barrier {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .image = image,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .oldLayout = uploaded ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL :
+                VK_IMAGE_LAYOUT_UNDEFINED,
         .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .subresourceRange = {
             .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = miplevel,
-            .levelCount = 1,
-            .layerCount = 1,
+            .levelCount = imageInfo.mipLevels,
+            .layerCount = imageInfo.arrayLayers,
         },
-        .srcAccessMask = 0,
+        .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
         .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
     };
-    VkBufferImageCopy upload {
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    vkCmdCopyBufferToImage(cmd, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            (uint32_t) pendingCopies.size(), pendingCopies.data());
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    pendingCopies.clear();
+    pendingTexels.clear();
+    uploaded = true;
+}
+
+void LavaTexture::update(const VkRect2D& rect, uint32_t mip, uint32_t layer,
+        void const* texels) noexcept {
+    LavaTextureImpl& impl = *upcast(this);
+    assert(impl.texelSize && "Partial updates require raw texels of a known size.");
+    assert(!impl.converted && "Partial updates are not supported for converted textures.");
+    assert(mip < impl.imageInfo.mipLevels && layer < impl.imageInfo.arrayLayers);
+    assert(rect.offset.x >= 0 && rect.offset.y >= 0);
+    assert(rect.offset.x + rect.extent.width <= std::max(impl.size.width >> mip, 1u));
+    assert(rect.offset.y + rect.extent.height <= std::max(impl.size.height >> mip, 1u));
+    const VkDeviceSize alignment = impl.stageAlignment;
+    const VkDeviceSize offset = (impl.pendingTexels.size() + alignment - 1) / alignment * alignment;
+    const VkDeviceSize nbytes = impl.texelSize * rect.extent.width * rect.extent.height;
+    impl.pendingTexels.resize(offset + nbytes);
+    memcpy(impl.pendingTexels.data() + offset, texels, nbytes);
+    impl.pendingCopies.push_back({
+        .bufferOffset = offset,
         .imageSubresource = {
             .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .mipLevel = miplevel,
+            .mipLevel = mip,
+            .baseArrayLayer = layer,
             .layerCount = 1,
         },
-        .imageExtent = {
-            .width = size.width >> miplevel,
-            .height = size.height >> miplevel,
-            .depth = 1,
-        }
-    };
-    VkImageMemoryBarrier barrier2 {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .image = image,
-        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = miplevel,
-            .levelCount = 1,
-            .layerCount = 1,
-        },
-        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT
-    };
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier1);
-    vkCmdCopyBufferToImage(cmd, stage, image,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &upload);
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier2);
+        .imageOffset = { rect.offset.x, rect.offset.y, 0 },
+        .imageExtent = { rect.extent.width, rect.extent.height, 1 },
+    });
 }
 
-VkImageView LavaTexture::getImageView() const noexcept {
-    return upcast(this)->view;
+void LavaTexture::uploadUpdates(VkCommandBuffer cmd) noexcept {
+    LavaTextureImpl& impl = *upcast(this);
+    if (impl.pendingCopies.empty()) {
+        return;
+    }
+    const VkDeviceSize nbytes = impl.pendingTexels.size();
+    if (impl.staging) {
+        LavaStagingRing::Allocation region {};
+        if (nbytes <= impl.staging->getCapacity()) {
+            region = impl.staging->allocate(nbytes, impl.stageAlignment);
+        }
+        if (region.mapped) {
+            memcpy(region.mapped, impl.pendingTexels.data(), nbytes);
+            impl.uploadUpdates(impl.staging->getCommandBuffer(), region.buffer, region.offset);
+            return;
+        }
+        llog.warn("Texture updates of {} bytes do not fit in the staging ring.", nbytes);
+    }
+
+    // The update stage is kept between calls and only grows when a larger batch comes along.
+    if (!impl.updateStageMem || getAllocationSize(impl.vma, impl.updateStageMem) < nbytes) {
+        impl.freeUpdateStage();
+        VkBufferCreateInfo bufferInfo {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = nbytes,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+        };
+        VmaAllocationCreateInfo stageInfo { .usage = VMA_MEMORY_USAGE_CPU_TO_GPU };
+        createPooledBuffer(impl.device, impl.vma, LavaMemoryPool::STAGING, bufferInfo, &stageInfo,
+                &impl.updateStage, &impl.updateStageMem);
+        trackMemory(impl.device, LAVA_MEMORY_TEXTURE,
+                getAllocationSize(impl.vma, impl.updateStageMem));
+    }
+    void* mappedData;
+    vmaMapMemory(impl.vma, impl.updateStageMem, &mappedData);
+    memcpy(mappedData, impl.pendingTexels.data(), nbytes);
+    vmaUnmapMemory(impl.vma, impl.updateStageMem);
+    impl.uploadUpdates(cmd, impl.updateStage, 0);
 }
 
 void LavaTexture::freeStage() noexcept {
     LavaTextureImpl& impl = *upcast(this);
+    impl.freeUpdateStage();
+    impl.freeConversion();
+    if (impl.stageMem) {
+        trackMemory(impl.device, LAVA_MEMORY_TEXTURE,
+                -(int64_t) getAllocationSize(impl.vma, impl.stageMem));
+    }
     vmaDestroyBuffer(impl.vma, impl.stage, impl.stageMem);
     impl.stage = 0;
     impl.stageMem = 0;
 }
 
 void LavaTexture::uploadStage(VkCommandBuffer cmd) const noexcept {
-    upcast(this)->uploadStage(cmd);
+    auto impl = upcast(this);
+    if (impl->ringStaged) {
+        return;
+    }
+    assert(impl->stage && "The stage has been freed or was never allocated.");
+    impl->uploadStage(cmd, impl->stage, 0);
+}
+
+void LavaTexture::uploadStage(VkCommandBuffer cmd, VkBuffer buffer, VkDeviceSize offset)
+        const noexcept {
+    auto impl = upcast(this);
+    LOG_CHECK(!impl->converted, "Converted textures must be uploaded from their own stage.");
+    impl->uploadStage(cmd, buffer, offset);
 }
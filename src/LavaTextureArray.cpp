@@ -0,0 +1,348 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#include <par/LavaLoader.h>
+#include <par/LavaTextureArray.h>
+#include <par/LavaLog.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "LavaInternal.h"
+
+using namespace par;
+using namespace std;
+
+namespace {
+
+// The skyline is a list of horizontal segments that trace the top edge of the packed rectangles,
+// sorted by x and covering the entire width of the layer.
+struct SkylineNode {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+};
+
+struct Skyline {
+    vector<SkylineNode> nodes;
+    bool insert(uint32_t width, uint32_t height, uint32_t layerHeight, uint32_t* x, uint32_t* y);
+    bool fit(size_t index, uint32_t width, uint32_t height, uint32_t layerHeight,
+            uint32_t* y) const;
+};
+
+struct LavaTextureArrayImpl : LavaTextureArray {
+    ~LavaTextureArrayImpl() noexcept;
+    bool relocate(LavaRelocation* reloc) noexcept;
+    Config config;
+    VmaAllocator vma;
+    vector<Item> items;
+    vector<VkDeviceSize> itemOffsets;
+    vector<uint8_t> texels;
+    vector<Skyline> skylines;
+    VkBuffer stage = VK_NULL_HANDLE;
+    VmaAllocation stageMem = VK_NULL_HANDLE;
+    VkImage image = VK_NULL_HANDLE;
+    VmaAllocation imageMem = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    VkImageCreateInfo imageInfo;
+    VkImageViewCreateInfo viewInfo;
+    VmaAllocationCreateInfo allocInfo;
+    LavaMovable movable;
+};
+
+LAVA_DEFINE_UPCAST(LavaTextureArray)
+
+} // anonymous namespace
+
+bool Skyline::fit(size_t index, uint32_t width, uint32_t height, uint32_t layerHeight,
+        uint32_t* y) const {
+    const uint32_t right = nodes[index].x + width;
+    uint32_t top = 0;
+    for (size_t i = index; i < nodes.size() && nodes[i].x < right; ++i) {
+        top = std::max(top, nodes[i].y);
+    }
+    const SkylineNode& last = nodes.back();
+    if (right > last.x + last.width || top + height > layerHeight) {
+        return false;
+    }
+    *y = top;
+    return true;
+}
+
+// Uses the bottom-left heuristic: the rectangle goes wherever its top edge ends up lowest, with
+// ties broken by choosing the narrowest segment.
+bool Skyline::insert(uint32_t width, uint32_t height, uint32_t layerHeight, uint32_t* x,
+        uint32_t* y) {
+    size_t best = nodes.size();
+    uint32_t bestBottom = ~0u;
+    uint32_t bestWidth = ~0u;
+    uint32_t bestY = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        uint32_t top;
+        if (!fit(i, width, height, layerHeight, &top)) {
+            continue;
+        }
+        if (top + height < bestBottom || (top + height == bestBottom &&
+                nodes[i].width < bestWidth)) {
+            best = i;
+            bestBottom = top + height;
+            bestWidth = nodes[i].width;
+            bestY = top;
+        }
+    }
+    if (best == nodes.size()) {
+        return false;
+    }
+    *x = nodes[best].x;
+    *y = bestY;
+
+    // Insert the new segment, then trim or remove the segments that it now shadows.
+    const SkylineNode node { nodes[best].x, bestY + height, width };
+    nodes.insert(nodes.begin() + best, node);
+    for (size_t i = best + 1; i < nodes.size();) {
+        const uint32_t right = node.x + node.width;
+        if (nodes[i].x >= right) {
+            break;
+        }
+        const uint32_t shrink = right - nodes[i].x;
+        if (shrink < nodes[i].width) {
+            nodes[i].x += shrink;
+            nodes[i].width -= shrink;
+            break;
+        }
+        nodes.erase(nodes.begin() + i);
+    }
+
+    // Merge neighbors that have the same height.
+    for (size_t i = 0; i + 1 < nodes.size();) {
+        if (nodes[i].y == nodes[i + 1].y) {
+            nodes[i].width += nodes[i + 1].width;
+            nodes.erase(nodes.begin() + i + 1);
+        } else {
+            ++i;
+        }
+    }
+    return true;
+}
+
+LavaTextureArray* LavaTextureArray::create(Config config) noexcept {
+    assert(config.device && config.gpu && config.texelSize > 0);
+    auto impl = new LavaTextureArrayImpl;
+    impl->config = config;
+    impl->vma = getVma(config.device, config.gpu);
+    return impl;
+}
+
+void LavaTextureArray::operator delete(void* ptr) {
+    auto impl = (LavaTextureArrayImpl*) ptr;
+    ::delete impl;
+}
+
+LavaTextureArrayImpl::~LavaTextureArrayImpl() noexcept {
+    freeStage();
+    if (image) {
+        unregisterMovable(config.device, &movable);
+        trackMemory(config.device, LAVA_MEMORY_TEXTURE,
+                -(int64_t) getAllocationSize(vma, imageMem));
+        vmaDestroyImage(vma, image, imageMem);
+        vkDestroyImageView(config.device, view, VKALLOC);
+    }
+}
+
+int32_t LavaTextureArray::add(uint32_t width, uint32_t height, void const* texels) noexcept {
+    LavaTextureArrayImpl& impl = *upcast(this);
+    const Config& config = impl.config;
+    if (impl.image || width > config.width || height > config.height) {
+        return -1;
+    }
+    Item item { .width = width, .height = height };
+    if (config.atlas) {
+        const uint32_t paddedWidth = std::min(width + config.padding, config.width);
+        const uint32_t paddedHeight = std::min(height + config.padding, config.height);
+        bool found = false;
+        for (size_t layer = 0; layer < impl.skylines.size() && !found; ++layer) {
+            item.layer = (uint32_t) layer;
+            found = impl.skylines[layer].insert(paddedWidth, paddedHeight, config.height,
+                    &item.x, &item.y);
+        }
+        if (!found) {
+            item.layer = (uint32_t) impl.skylines.size();
+            impl.skylines.push_back({{ {0, 0, config.width} }});
+            impl.skylines.back().insert(paddedWidth, paddedHeight, config.height, &item.x,
+                    &item.y);
+        }
+    } else {
+        item.layer = (uint32_t) impl.items.size();
+    }
+    item.uvRect[0] = float(item.x) / config.width;
+    item.uvRect[1] = float(item.y) / config.height;
+    item.uvRect[2] = float(item.x + width) / config.width;
+    item.uvRect[3] = float(item.y + height) / config.height;
+
+    // Regions in the stage must be aligned to the texel size and to 4 bytes.
+    const VkDeviceSize alignment = config.texelSize * 4;
+    const VkDeviceSize offset = (impl.texels.size() + alignment - 1) / alignment * alignment;
+    const VkDeviceSize nbytes = VkDeviceSize(width) * height * config.texelSize;
+    impl.texels.resize(offset + nbytes);
+    memcpy(impl.texels.data() + offset, texels, nbytes);
+    impl.itemOffsets.push_back(offset);
+    impl.items.push_back(item);
+    return (int32_t) impl.items.size() - 1;
+}
+
+void LavaTextureArray::uploadStage(VkCommandBuffer cmd) noexcept {
+    LavaTextureArrayImpl& impl = *upcast(this);
+    const Config& config = impl.config;
+    const VkDevice device = config.device;
+    assert(!impl.image && !impl.items.empty());
+    const uint32_t layerCount = getLayerCount();
+
+    VkBufferCreateInfo bufferInfo {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = impl.texels.size(),
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    };
+    VmaAllocationCreateInfo stageInfo { .usage = VMA_MEMORY_USAGE_CPU_TO_GPU };
+    createPooledBuffer(device, impl.vma, LavaMemoryPool::STAGING, bufferInfo, &stageInfo,
+            &impl.stage, &impl.stageMem);
+    trackMemory(device, LAVA_MEMORY_TEXTURE, getAllocationSize(impl.vma, impl.stageMem));
+    void* mappedData;
+    vmaMapMemory(impl.vma, impl.stageMem, &mappedData);
+    memcpy(mappedData, impl.texels.data(), impl.texels.size());
+    vmaUnmapMemory(impl.vma, impl.stageMem);
+    impl.texels = {};
+
+    impl.imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent = { config.width, config.height, 1 },
+        .format = config.format,
+        .mipLevels = 1,
+        .arrayLayers = layerCount,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+    };
+    impl.allocInfo = { .usage = VMA_MEMORY_USAGE_GPU_ONLY };
+    const LavaMemoryPool pool = config.pool == LavaMemoryPool::AUTO ? LavaMemoryPool::TEXTURE :
+            config.pool;
+    createPooledImage(device, impl.vma, pool, impl.imageInfo, &impl.allocInfo, &impl.image,
+            &impl.imageMem);
+    trackMemory(device, LAVA_MEMORY_TEXTURE, getAllocationSize(impl.vma, impl.imageMem));
+    impl.viewInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = impl.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+        .format = config.format,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .levelCount = 1,
+            .layerCount = layerCount
+        }
+    };
+    vkCreateImageView(device, &impl.viewInfo, VKALLOC, &impl.view);
+    impl.movable = {
+        .allocation = &impl.imageMem,
+        .pool = impl.allocInfo.pool,
+        .relocate = [&impl] (LavaRelocation* reloc) { return impl.relocate(reloc); }
+    };
+    registerMovable(device, &impl.movable);
+
+    const VkImageSubresourceRange range {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .levelCount = 1,
+        .layerCount = layerCount,
+    };
+    VkImageMemoryBarrier barrier1 {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .image = impl.image,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .subresourceRange = range,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+    };
+    vector<VkBufferImageCopy> regions(impl.items.size());
+    for (size_t i = 0; i < regions.size(); ++i) {
+        const Item& item = impl.items[i];
+        regions[i] = {
+            .bufferOffset = impl.itemOffsets[i],
+            .imageSubresource = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseArrayLayer = item.layer,
+                .layerCount = 1,
+            },
+            .imageOffset = { (int32_t) item.x, (int32_t) item.y, 0 },
+            .imageExtent = { item.width, item.height, 1 },
+        };
+    }
+    VkImageMemoryBarrier barrier2 {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .image = impl.image,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .subresourceRange = range,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier1);
+    vkCmdCopyBufferToImage(cmd, impl.stage, impl.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            (uint32_t) regions.size(), regions.data());
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier2);
+}
+
+void LavaTextureArray::freeStage() noexcept {
+    LavaTextureArrayImpl& impl = *upcast(this);
+    if (impl.stageMem) {
+        trackMemory(impl.config.device, LAVA_MEMORY_TEXTURE,
+                -(int64_t) getAllocationSize(impl.vma, impl.stageMem));
+        vmaDestroyBuffer(impl.vma, impl.stage, impl.stageMem);
+    }
+    impl.stage = VK_NULL_HANDLE;
+    impl.stageMem = VK_NULL_HANDLE;
+}
+
+bool LavaTextureArrayImpl::relocate(LavaRelocation* reloc) noexcept {
+    VkImage newImage;
+    VmaAllocation newMemory;
+    if (!createRelocatedImage(vma, imageInfo, allocInfo, reloc, &newImage, &newMemory)) {
+        return false;
+    }
+    recordImageMove(reloc->cmd, image, newImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            imageInfo.extent, 1, imageInfo.arrayLayers);
+    reloc->images.emplace_back(image, imageMem);
+    reloc->views.push_back(view);
+    reloc->oldView = view;
+    viewInfo.image = image = newImage;
+    imageMem = newMemory;
+    vkCreateImageView(config.device, &viewInfo, VKALLOC, &view);
+    reloc->newView = view;
+    return true;
+}
+
+const LavaTextureArray::Item& LavaTextureArray::getItem(uint32_t index) const noexcept {
+    return upcast(this)->items[index];
+}
+
+uint32_t LavaTextureArray::getItemCount() const noexcept {
+    return (uint32_t) upcast(this)->items.size();
+}
+
+uint32_t LavaTextureArray::getLayerCount() const noexcept {
+    auto impl = upcast(this);
+    return (uint32_t) (impl->config.atlas ? impl->skylines.size() : impl->items.size());
+}
+
+VkImage LavaTextureArray::getImage() const noexcept {
+    return upcast(this)->image;
+}
+
+VkImageView LavaTextureArray::getImageView() const noexcept {
+    return upcast(this)->view;
+}
@@ -0,0 +1,322 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+#include <par/LavaLoader.h>
+#include <par/LavaTextureLoader.h>
+#include <par/LavaTexture.h>
+#include <par/LavaLog.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LavaInternal.h"
+
+using namespace par;
+using namespace std;
+
+namespace {
+
+enum JobState { DECODING, UPLOADING, READY, FAILED };
+
+struct Job {
+    LavaTextureLoader::Decoder decoder;
+    LavaTextureLoader::ImageInfo info;
+    VkBuffer stage;
+    VmaAllocation stageMem;
+    LavaTexture* texture;
+
+    // Workers publish failures without holding the queue mutex, so the state is atomic. Release
+    // stores make the job's other fields visible to threads that observe the new state.
+    atomic<JobState> state;
+};
+
+struct Batch {
+    VkCommandBuffer cmd;
+    VkFence fence;
+    vector<Job*> jobs;
+};
+
+struct LavaTextureLoaderImpl : LavaTextureLoader {
+    ~LavaTextureLoaderImpl() noexcept;
+    void work() noexcept;
+    void decode(Job* job) noexcept;
+    void freeStage(Job* job) noexcept;
+    void retire(bool wait) noexcept;
+    Config config;
+    VmaAllocator vma;
+    VkCommandPool pool;
+    vector<thread> threads;
+    vector<Job*> jobs;
+    deque<Batch> batches;
+
+    // The following fields are shared with worker threads.
+    mutex queueMutex;
+    condition_variable queueCondition;
+    deque<Job*> decodeQueue;
+    vector<Job*> decoded;
+    uint32_t decodingCount = 0;
+    VkDeviceSize stagingBytes = 0;
+    bool quit = false;
+};
+
+LAVA_DEFINE_UPCAST(LavaTextureLoader)
+
+} // anonymous namespace
+
+LavaTextureLoader* LavaTextureLoader::create(Config config) noexcept {
+    assert(config.device && config.gpu && config.queue);
+    auto impl = new LavaTextureLoaderImpl;
+    impl->config = config;
+    impl->vma = getVma(config.device, config.gpu);
+    const VkCommandPoolCreateInfo poolInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .queueFamilyIndex = config.queueFamily,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+    };
+    VkResult error = vkCreateCommandPool(config.device, &poolInfo, VKALLOC, &impl->pool);
+    LOG_CHECK(not error, "Unable to create command pool.");
+    uint32_t threadCount = config.threadCount;
+    if (threadCount == 0) {
+        threadCount = std::max(thread::hardware_concurrency(), 2u) - 1;
+    }
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        impl->threads.emplace_back([impl] { impl->work(); });
+    }
+    return impl;
+}
+
+void LavaTextureLoader::operator delete(void* ptr) {
+    auto impl = (LavaTextureLoaderImpl*) ptr;
+    ::delete impl;
+}
+
+LavaTextureLoaderImpl::~LavaTextureLoaderImpl() noexcept {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        quit = true;
+    }
+    queueCondition.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    retire(true);
+    for (Job* job : jobs) {
+        freeStage(job);
+        delete job->texture;
+        delete job;
+    }
+    vkDestroyCommandPool(config.device, pool, VKALLOC);
+}
+
+void LavaTextureLoaderImpl::work() noexcept {
+    while (true) {
+        Job* job;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this] { return quit || !decodeQueue.empty(); });
+            if (quit) {
+                return;
+            }
+            job = decodeQueue.front();
+            decodeQueue.pop_front();
+        }
+        decode(job);
+        {
+            lock_guard<mutex> lock(queueMutex);
+            decoded.push_back(job);
+            --decodingCount;
+        }
+        queueCondition.notify_all();
+    }
+}
+
+void LavaTextureLoaderImpl::decode(Job* job) noexcept {
+    uint8_t* mapped = nullptr;
+    auto allocate = [this, job, &mapped] (const ImageInfo& info) -> uint8_t* {
+        assert(!mapped && "allocate can only be called once per image.");
+        job->info = info;
+
+        // Wait for earlier uploads to release their staging memory if this one would exceed the
+        // budget. A single image is always admitted so that oversized images cannot deadlock.
+        const VkDeviceSize budget = config.stagingBudget;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this, &info, budget] {
+                return quit || !budget || !stagingBytes || stagingBytes + info.size <= budget;
+            });
+            stagingBytes += info.size;
+        }
+        VkBufferCreateInfo bufferInfo {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = info.size,
+            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+        };
+        VmaAllocationCreateInfo stageInfo { .usage = VMA_MEMORY_USAGE_CPU_TO_GPU };
+        createPooledBuffer(config.device, vma, LavaMemoryPool::STAGING, bufferInfo, &stageInfo,
+                &job->stage, &job->stageMem);
+        trackMemory(config.device, LAVA_MEMORY_TEXTURE, getAllocationSize(vma, job->stageMem));
+        vmaMapMemory(vma, job->stageMem, (void**) &mapped);
+        return mapped;
+    };
+    const bool success = job->decoder(allocate);
+    if (mapped) {
+        vmaUnmapMemory(vma, job->stageMem);
+    }
+    job->decoder = nullptr;
+    if (!success || !mapped) {
+        freeStage(job);
+        job->state.store(FAILED, memory_order_release);
+    }
+}
+
+void LavaTextureLoaderImpl::freeStage(Job* job) noexcept {
+    if (job->stageMem) {
+        trackMemory(config.device, LAVA_MEMORY_TEXTURE,
+                -(int64_t) getAllocationSize(vma, job->stageMem));
+        vmaDestroyBuffer(vma, job->stage, job->stageMem);
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stagingBytes -= job->info.size;
+        }
+        queueCondition.notify_all();
+    }
+    job->stage = VK_NULL_HANDLE;
+    job->stageMem = VK_NULL_HANDLE;
+}
+
+// Publishes the textures from every batch whose fence has signaled, in submission order.
+void LavaTextureLoaderImpl::retire(bool wait) noexcept {
+    while (!batches.empty()) {
+        Batch& batch = batches.front();
+        if (wait) {
+            vkWaitForFences(config.device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        } else if (vkGetFenceStatus(config.device, batch.fence) != VK_SUCCESS) {
+            return;
+        }
+        for (Job* job : batch.jobs) {
+            freeStage(job);
+            job->state.store(READY, memory_order_release);
+        }
+        vkDestroyFence(config.device, batch.fence, VKALLOC);
+        vkFreeCommandBuffers(config.device, pool, 1, &batch.cmd);
+        batches.pop_front();
+    }
+}
+
+LavaTextureLoader::Handle LavaTextureLoader::load(Decoder decoder) noexcept {
+    LavaTextureLoaderImpl* impl = upcast(this);
+    Job* job = new Job {
+        .decoder = decoder,
+        .stage = VK_NULL_HANDLE,
+        .stageMem = VK_NULL_HANDLE,
+        .texture = nullptr,
+        .state = {DECODING},
+    };
+    const Handle handle = (Handle) impl->jobs.size();
+    impl->jobs.push_back(job);
+    {
+        lock_guard<mutex> lock(impl->queueMutex);
+        impl->decodeQueue.push_back(job);
+        ++impl->decodingCount;
+    }
+    impl->queueCondition.notify_one();
+    return handle;
+}
+
+void LavaTextureLoader::update() noexcept {
+    LavaTextureLoaderImpl* impl = upcast(this);
+    impl->retire(false);
+    vector<Job*> decoded;
+    {
+        lock_guard<mutex> lock(impl->queueMutex);
+        swap(decoded, impl->decoded);
+    }
+    if (decoded.empty()) {
+        return;
+    }
+
+    Batch batch;
+    const VkCommandBufferAllocateInfo allocInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = impl->pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    vkAllocateCommandBuffers(impl->config.device, &allocInfo, &batch.cmd);
+    const VkCommandBufferBeginInfo beginInfo {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    vkBeginCommandBuffer(batch.cmd, &beginInfo);
+    for (Job* job : decoded) {
+        if (job->state.load(memory_order_acquire) == FAILED) {
+            continue;
+        }
+        const ImageInfo& info = job->info;
+        job->texture = LavaTexture::create({
+            .device = impl->config.device,
+            .gpu = impl->config.gpu,
+            .size = info.size,
+            .width = info.width,
+            .height = info.height,
+            .format = info.format,
+            .mipmaps = info.mipmaps,
+            .externalStage = true,
+        });
+        job->texture->uploadStage(batch.cmd, job->stage, 0);
+        job->state.store(UPLOADING, memory_order_release);
+        batch.jobs.push_back(job);
+    }
+    vkEndCommandBuffer(batch.cmd);
+    const VkFenceCreateInfo fenceInfo { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    vkCreateFence(impl->config.device, &fenceInfo, VKALLOC, &batch.fence);
+    const VkSubmitInfo submitInfo {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &batch.cmd,
+    };
+    VkResult error = vkQueueSubmit(impl->config.queue, 1, &submitInfo, batch.fence);
+    LOG_CHECK(not error, "Unable to submit texture uploads.");
+    impl->batches.push_back(batch);
+}
+
+LavaTexture* LavaTextureLoader::getTexture(Handle handle) const noexcept {
+    Job* job = upcast(this)->jobs[handle];
+    return job->state.load(memory_order_acquire) == READY ? job->texture : nullptr;
+}
+
+bool LavaTextureLoader::isReady(Handle handle) const noexcept {
+    return upcast(this)->jobs[handle]->state.load(memory_order_acquire) == READY;
+}
+
+bool LavaTextureLoader::hasFailed(Handle handle) const noexcept {
+    return upcast(this)->jobs[handle]->state.load(memory_order_acquire) == FAILED;
+}
+
+void LavaTextureLoader::unload(Handle handle) noexcept {
+    Job* job = upcast(this)->jobs[handle];
+    assert(job->state.load(memory_order_acquire) != DECODING &&
+            job->state.load(memory_order_acquire) != UPLOADING);
+    delete job->texture;
+    job->texture = nullptr;
+    job->state.store(FAILED, memory_order_release);
+}
+
+void LavaTextureLoader::finish() noexcept {
+    LavaTextureLoaderImpl* impl = upcast(this);
+    while (true) {
+        update();
+        impl->retire(true);
+        unique_lock<mutex> lock(impl->queueMutex);
+        if (impl->decodingCount == 0 && impl->decoded.empty()) {
+            return;
+        }
+        impl->queueCondition.wait(lock, [impl] {
+            return impl->decodingCount == 0 || !impl->decoded.empty();
+        });
+    }
+}
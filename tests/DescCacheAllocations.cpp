@@ -0,0 +1,130 @@
+// The MIT License
+// Copyright (c) 2018 Philip Rideout
+
+// Verifies that LavaDescCache::getDescriptorSet does not touch the heap once the cache has warmed
+// up, for both hits and misses that fit in the existing descriptor pools. The Vulkan entry points
+// that the cache uses are replaced with stubs, so this runs without a GPU or a Vulkan loader.
+
+#include <par/LavaLoader.h>
+#include <par/LavaDescCache.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace par;
+
+static size_t sAllocations = 0;
+
+void* operator new(size_t size) {
+    ++sAllocations;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        abort();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+namespace {
+
+uint64_t sNextHandle = 1;
+
+template <typename T> T makeHandle() {
+    return (T) (uintptr_t) sNextHandle++;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL createSetLayout(VkDevice, const VkDescriptorSetLayoutCreateInfo*,
+        const VkAllocationCallbacks*, VkDescriptorSetLayout* layout) {
+    *layout = makeHandle<VkDescriptorSetLayout>();
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL destroySetLayout(VkDevice, VkDescriptorSetLayout,
+        const VkAllocationCallbacks*) {}
+
+VKAPI_ATTR VkResult VKAPI_CALL createPool(VkDevice, const VkDescriptorPoolCreateInfo*,
+        const VkAllocationCallbacks*, VkDescriptorPool* pool) {
+    *pool = makeHandle<VkDescriptorPool>();
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL destroyPool(VkDevice, VkDescriptorPool, const VkAllocationCallbacks*) {}
+
+VKAPI_ATTR VkResult VKAPI_CALL allocateSets(VkDevice, const VkDescriptorSetAllocateInfo*,
+        VkDescriptorSet* sets) {
+    *sets = makeHandle<VkDescriptorSet>();
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL freeSets(VkDevice, VkDescriptorPool, uint32_t,
+        const VkDescriptorSet*) {
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL updateSets(VkDevice, uint32_t, const VkWriteDescriptorSet*, uint32_t,
+        const VkCopyDescriptorSet*) {}
+
+// The first pool holds 64 sets and the second holds 128, so warming up with 65 entries creates
+// both pools, and the next 127 misses fit in the pools without creating another one.
+constexpr uint32_t WARM_ENTRIES = 65;
+constexpr uint32_t TOTAL_ENTRIES = 64 + 128;
+constexpr uint32_t HIT_PASSES = 4;
+
+VkBuffer getBuffer(uint32_t index) {
+    return (VkBuffer) (uintptr_t) (0x10000 + index);
+}
+
+bool check(const char* label, size_t allocations) {
+    printf("%s: %zu allocations\n", label, allocations);
+    return allocations == 0;
+}
+
+} // anonymous namespace
+
+int main() {
+    vkCreateDescriptorSetLayout = createSetLayout;
+    vkDestroyDescriptorSetLayout = destroySetLayout;
+    vkCreateDescriptorPool = createPool;
+    vkDestroyDescriptorPool = destroyPool;
+    vkAllocateDescriptorSets = allocateSets;
+    vkFreeDescriptorSets = freeSets;
+    vkUpdateDescriptorSets = updateSets;
+
+    LavaDescCache* cache = LavaDescCache::create({
+        .device = (VkDevice) (uintptr_t) 1,
+        .uniformBuffers = { VK_NULL_HANDLE },
+    });
+
+    VkDescriptorSet set;
+    for (uint32_t i = 0; i < WARM_ENTRIES; ++i) {
+        cache->setUniformBuffer(0, getBuffer(i));
+        cache->getDescriptorSet(&set, nullptr);
+    }
+
+    sAllocations = 0;
+    for (uint32_t pass = 0; pass < HIT_PASSES; ++pass) {
+        for (uint32_t i = 0; i < WARM_ENTRIES; ++i) {
+            cache->setUniformBuffer(0, getBuffer(i));
+            cache->getDescriptorSet(&set, nullptr);
+        }
+    }
+    bool passed = check("Hits", sAllocations);
+
+    sAllocations = 0;
+    for (uint32_t i = WARM_ENTRIES; i < TOTAL_ENTRIES; ++i) {
+        cache->setUniformBuffer(0, getBuffer(i));
+        cache->getDescriptorSet(&set, nullptr);
+    }
+    passed = check("Misses", sAllocations) && passed;
+
+    delete cache;
+    return passed ? 0 : 1;
+}